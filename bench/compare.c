@@ -0,0 +1,234 @@
+/*
+ * Workloads shared with compare.cpp, built once against this library and
+ * once against the C library's native <threads.h>.
+ *
+ * Usage: compare [threads]
+ *
+ * Only standard C11 calls are used, so the same file compiles for
+ * either backend: with -I.. "threads.h" is the emulation, without -I..
+ * the include falls through to the system header. compare.sh builds every backend and prints the
+ * results side by side.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "threads.h"
+
+#if defined(EMULATED_THREADS_H_INCLUDED_) && !defined(IMPL_THRD_NATIVE)
+#define BACKEND "emulated"
+#else
+#define BACKEND "native"
+#endif
+
+#define RUNS 5
+#define MAX_THREADS 256
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* median ns/op over RUNS runs of fn */
+static void
+report(const char *name, int threads, long ops, uint64_t (*fn)(long ops, int threads))
+{
+    double r[RUNS];
+    int i;
+    fn(ops / 10, threads);  // warm up
+    for (i = 0; i < RUNS; i++)
+        r[i] = (double)fn(ops, threads) / (double)ops;
+    qsort(r, RUNS, sizeof(r[0]), cmp_double);
+    printf("%s,%d,%s,%.2f\n", name, threads, BACKEND, r[RUNS / 2]);
+    fflush(stdout);
+}
+
+/*------------------------- workloads -------------------------*/
+static mtx_t lock;
+static volatile unsigned long counter;
+
+static uint64_t
+mtx_uncontended(long ops, int threads)
+{
+    uint64_t t0;
+    long i;
+    (void)threads;
+    mtx_init(&lock, mtx_plain);
+    t0 = now_ns();
+    for (i = 0; i < ops; i++) {
+        mtx_lock(&lock);
+        counter++;
+        mtx_unlock(&lock);
+    }
+    t0 = now_ns() - t0;
+    mtx_destroy(&lock);
+    return t0;
+}
+
+static long contended_ops;
+
+static int
+contended_main(void *arg)
+{
+    long i;
+    (void)arg;
+    for (i = 0; i < contended_ops; i++) {
+        mtx_lock(&lock);
+        counter++;
+        mtx_unlock(&lock);
+    }
+    return 0;
+}
+
+/* wall time for every thread to do ops acquisitions */
+static uint64_t
+mtx_contended(long ops, int threads)
+{
+    thrd_t thr[MAX_THREADS];
+    uint64_t t0;
+    int i;
+    mtx_init(&lock, mtx_plain);
+    contended_ops = ops;
+    t0 = now_ns();
+    for (i = 0; i < threads; i++)
+        thrd_create(&thr[i], contended_main, NULL);
+    for (i = 0; i < threads; i++)
+        thrd_join(thr[i], NULL);
+    t0 = now_ns() - t0;
+    mtx_destroy(&lock);
+    return t0;
+}
+
+static cnd_t ping_cnd;
+static long ping_turn, ping_ops;
+
+static int
+pong_main(void *arg)
+{
+    long i;
+    (void)arg;
+    mtx_lock(&lock);
+    for (i = 0; i < ping_ops; i++) {
+        while (!(ping_turn & 1))
+            cnd_wait(&ping_cnd, &lock);
+        ping_turn++;
+        cnd_signal(&ping_cnd);
+    }
+    mtx_unlock(&lock);
+    return 0;
+}
+
+/* one op is a round trip: two signals and two wake-ups */
+static uint64_t
+cnd_pingpong(long ops, int threads)
+{
+    thrd_t thr;
+    uint64_t t0;
+    long i;
+    (void)threads;
+    mtx_init(&lock, mtx_plain);
+    cnd_init(&ping_cnd);
+    ping_turn = 0;
+    ping_ops = ops;
+    thrd_create(&thr, pong_main, NULL);
+    t0 = now_ns();
+    mtx_lock(&lock);
+    for (i = 0; i < ops; i++) {
+        ping_turn++;
+        cnd_signal(&ping_cnd);
+        while (ping_turn & 1)
+            cnd_wait(&ping_cnd, &lock);
+    }
+    mtx_unlock(&lock);
+    t0 = now_ns() - t0;
+    thrd_join(thr, NULL);
+    cnd_destroy(&ping_cnd);
+    mtx_destroy(&lock);
+    return t0;
+}
+
+static int
+empty_main(void *arg)
+{
+    (void)arg;
+    return 0;
+}
+
+static uint64_t
+thrd_create_join(long ops, int threads)
+{
+    thrd_t thr;
+    uint64_t t0;
+    long i;
+    (void)threads;
+    t0 = now_ns();
+    for (i = 0; i < ops; i++) {
+        thrd_create(&thr, empty_main, NULL);
+        thrd_join(thr, NULL);
+    }
+    return now_ns() - t0;
+}
+
+static uint64_t
+tss_get_set(long ops, int threads)
+{
+    tss_t key;
+    uint64_t t0;
+    long i;
+    (void)threads;
+    tss_create(&key, NULL);
+    t0 = now_ns();
+    for (i = 0; i < ops; i++)
+        tss_set(key, (char *)tss_get(key) + 1);
+    t0 = now_ns() - t0;
+    tss_delete(key);
+    return t0;
+}
+
+static once_flag flag = ONCE_FLAG_INIT;
+
+static void
+once_fn(void)
+{
+    counter++;
+}
+
+static uint64_t
+call_once_done(long ops, int threads)
+{
+    uint64_t t0;
+    long i;
+    (void)threads;
+    t0 = now_ns();
+    for (i = 0; i < ops; i++)
+        call_once(&flag, once_fn);
+    return now_ns() - t0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    if (threads < 1 || threads > MAX_THREADS) {
+        fprintf(stderr, "usage: %s [threads]\n", argv[0]);
+        return 2;
+    }
+    report("mtx_uncontended", 1, 10000000, mtx_uncontended);
+    report("mtx_contended", threads, 1000000, mtx_contended);
+    report("cnd_pingpong", 2, 100000, cnd_pingpong);
+    report("thrd_create_join", 1, 10000, thrd_create_join);
+    report("tss_get_set", 1, 10000000, tss_get_set);
+    report("call_once", 1, 10000000, call_once_done);
+    return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * The workloads of compare.c on the C++ standard library primitives:
+ * std::mutex, std::condition_variable, std::thread, thread_local and
+ * std::call_once.
+ *
+ * Usage: compare_cxx [threads]
+ */
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define BACKEND "cxx"
+
+static const int RUNS = 5;
+static const int MAX_THREADS = 256;
+
+static uint64_t
+now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void
+report(const char *name, int threads, long ops, uint64_t (*fn)(long ops, int threads))
+{
+    double r[RUNS];
+    fn(ops / 10, threads);  // warm up
+    for (int i = 0; i < RUNS; i++)
+        r[i] = (double)fn(ops, threads) / (double)ops;
+    std::sort(r, r + RUNS);
+    std::printf("%s,%d,%s,%.2f\n", name, threads, BACKEND, r[RUNS / 2]);
+    std::fflush(stdout);
+}
+
+/*------------------------- workloads -------------------------*/
+static std::mutex lock;
+static volatile unsigned long counter;
+
+static uint64_t
+mtx_uncontended(long ops, int)
+{
+    uint64_t t0 = now_ns();
+    for (long i = 0; i < ops; i++) {
+        lock.lock();
+        counter++;
+        lock.unlock();
+    }
+    return now_ns() - t0;
+}
+
+static uint64_t
+mtx_contended(long ops, int threads)
+{
+    std::vector<std::thread> thr;
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < threads; i++)
+        thr.emplace_back([ops] {
+            for (long j = 0; j < ops; j++) {
+                lock.lock();
+                counter++;
+                lock.unlock();
+            }
+        });
+    for (auto &t : thr)
+        t.join();
+    return now_ns() - t0;
+}
+
+static uint64_t
+cnd_pingpong(long ops, int)
+{
+    std::condition_variable cnd;
+    long turn = 0;
+    std::thread pong([&] {
+        std::unique_lock<std::mutex> l(lock);
+        for (long i = 0; i < ops; i++) {
+            while (!(turn & 1))
+                cnd.wait(l);
+            turn++;
+            cnd.notify_one();
+        }
+    });
+    uint64_t t0 = now_ns();
+    {
+        std::unique_lock<std::mutex> l(lock);
+        for (long i = 0; i < ops; i++) {
+            turn++;
+            cnd.notify_one();
+            while (turn & 1)
+                cnd.wait(l);
+        }
+    }
+    t0 = now_ns() - t0;
+    pong.join();
+    return t0;
+}
+
+static uint64_t
+thrd_create_join(long ops, int)
+{
+    uint64_t t0 = now_ns();
+    for (long i = 0; i < ops; i++)
+        std::thread([] {}).join();
+    return now_ns() - t0;
+}
+
+static thread_local char *tls_value;
+
+static uint64_t
+tss_get_set(long ops, int)
+{
+    uint64_t t0 = now_ns();
+    for (long i = 0; i < ops; i++) {
+        char *p = tls_value;
+        // keep the access from being folded into one add
+        __asm__ __volatile__("" : "+r"(p));
+        tls_value = p + 1;
+    }
+    return now_ns() - t0;
+}
+
+static std::once_flag flag;
+
+static uint64_t
+call_once_done(long ops, int)
+{
+    uint64_t t0 = now_ns();
+    for (long i = 0; i < ops; i++)
+        std::call_once(flag, [] { counter++; });
+    return now_ns() - t0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int threads = argc > 1 ? std::atoi(argv[1]) : 4;
+    if (threads < 1 || threads > MAX_THREADS) {
+        std::fprintf(stderr, "usage: %s [threads]\n", argv[0]);
+        return 2;
+    }
+    report("mtx_uncontended", 1, 10000000, mtx_uncontended);
+    report("mtx_contended", threads, 1000000, mtx_contended);
+    report("cnd_pingpong", 2, 100000, cnd_pingpong);
+    report("thrd_create_join", 1, 10000, thrd_create_join);
+    report("tss_get_set", 1, 10000000, tss_get_set);
+    report("call_once", 1, 10000000, call_once_done);
+    return 0;
+}
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Build compare.c against the emulation and the native <threads.h>,
+# compare.cpp against the C++ standard library, run all three and print
+# ns/op side by side.
+#
+# Usage: compare.sh [threads]
+# Environment: CC, CXX, CFLAGS, CXXFLAGS; COMPAT_INCLUDE is the directory
+# holding c99_compat.h (Mesa's include/).
+
+set -e
+cd "$(dirname "$0")"
+CC=${CC:-cc}
+CXX=${CXX:-c++}
+CFLAGS=${CFLAGS:--O2}
+CXXFLAGS=${CXXFLAGS:--O2}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+$CC -std=c99 $CFLAGS -DHAVE_PTHREAD -I.. ${COMPAT_INCLUDE:+-I"$COMPAT_INCLUDE"} \
+    compare.c -o "$tmp/emulated" -lpthread
+"$tmp/emulated" "$@" > "$tmp/emulated.csv"
+
+if $CC -std=c11 $CFLAGS compare.c -o "$tmp/native" -pthread 2>/dev/null; then
+    "$tmp/native" "$@" > "$tmp/native.csv"
+else
+    echo "native <threads.h> not available" >&2
+    : > "$tmp/native.csv"
+fi
+
+if $CXX -std=c++11 $CXXFLAGS compare.cpp -o "$tmp/cxx" -pthread; then
+    "$tmp/cxx" "$@" > "$tmp/cxx.csv"
+else
+    : > "$tmp/cxx.csv"
+fi
+
+echo "workload,threads,emulated_ns,native_ns,cxx_ns"
+awk -F, '
+    FILENAME ~ /native/ { native[$1] = $4; next }
+    FILENAME ~ /cxx/    { cxx[$1] = $4; next }
+    { order[n++] = $1; threads[$1] = $2; emulated[$1] = $4 }
+    END {
+        for (i = 0; i < n; i++) {
+            w = order[i]
+            printf "%s,%s,%s,%s,%s\n", w, threads[w], emulated[w], native[w], cxx[w]
+        }
+    }' "$tmp/native.csv" "$tmp/cxx.csv" "$tmp/emulated.csv"
@@ -0,0 +1,140 @@
+/*
+ * Increment rate of a shared statistics counter.
+ *
+ * Usage: counters [max_threads] [ms]
+ *
+ * Every thread increments the same counter in a loop: one guarded by
+ * an mtx_t, one updated with an atomic add and a pcpu_counter_t. The
+ * per-CPU counter is also measured with rseq disabled, which gives
+ * every thread its own slot updated atomically. The final sum is
+ * checked against the increments counted by the threads.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include "threads.h"
+#include "pcpu_counter.h"
+
+#define MAX_THREADS 64
+
+static mtx_t lock;
+static int64_t locked_count;
+static int64_t atomic_count;
+static pcpu_counter_t pcpu;
+static volatile int stop;
+
+static void
+inc_mtx(void)
+{
+    mtx_lock(&lock);
+    locked_count++;
+    mtx_unlock(&lock);
+}
+
+static int64_t
+read_mtx(void)
+{
+    return locked_count;
+}
+
+static void
+inc_atomic(void)
+{
+    __atomic_fetch_add(&atomic_count, 1, __ATOMIC_RELAXED);
+}
+
+static int64_t
+read_atomic(void)
+{
+    return atomic_count;
+}
+
+static void
+inc_pcpu(void)
+{
+    pcpu_counter_inc(&pcpu);
+}
+
+static int64_t
+read_pcpu(void)
+{
+    return pcpu_counter_read(&pcpu);
+}
+
+static const struct counter_ops {
+    const char *name;
+    void (*inc)(void);
+    int64_t (*read)(void);
+    int no_rseq;
+} counters[] = {
+    { "mtx", inc_mtx, read_mtx, 0 },
+    { "atomic", inc_atomic, read_atomic, 0 },
+    { "pcpu_counter", inc_pcpu, read_pcpu, 0 },
+    { "pcpu_counter_no_rseq", inc_pcpu, read_pcpu, 1 },
+};
+static const struct counter_ops *cur;
+static unsigned long counts[MAX_THREADS];
+
+static int
+worker_main(void *arg)
+{
+    unsigned long *count = (unsigned long *)arg, n = 0;
+    if (cur->no_rseq)
+        rseq_disable_current_thread();
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        cur->inc();
+        n++;
+    }
+    *count = n;
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    long ms = argc > 2 ? atol(argv[2]) : 500;
+    struct timespec run;
+    size_t c;
+    int i, n;
+
+    if (max_threads < 1 || max_threads > MAX_THREADS || ms <= 0) {
+        fprintf(stderr, "usage: %s [max_threads] [ms]\n", argv[0]);
+        return 2;
+    }
+    run.tv_sec = ms / 1000;
+    run.tv_nsec = (ms % 1000) * 1000000;
+    mtx_init(&lock, mtx_plain);
+
+    printf("counter,threads,mincs_per_sec\n");
+    for (c = 0; c < sizeof(counters) / sizeof(counters[0]); c++) {
+        cur = &counters[c];
+        for (n = 1; n <= max_threads; n *= 2) {
+            thrd_t thr[MAX_THREADS];
+            unsigned long total = 0;
+
+            locked_count = atomic_count = 0;
+            if (pcpu_counter_init(&pcpu) != thrd_success)
+                return 1;
+            stop = 0;
+            for (i = 0; i < n; i++)
+                thrd_create(&thr[i], worker_main, &counts[i]);
+            thrd_sleep(&run, NULL);
+            __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+            for (i = 0; i < n; i++) {
+                thrd_join(thr[i], NULL);
+                total += counts[i];
+            }
+            if (cur->read() != (int64_t)total) {
+                fprintf(stderr, "%s: sum %lld, expected %lu\n", cur->name,
+                        (long long)cur->read(), total);
+                return 1;
+            }
+            printf("%s,%d,%.1f\n", cur->name, n, total / (ms * 1000.0));
+            fflush(stdout);
+            pcpu_counter_destroy(&pcpu);
+        }
+    }
+    mtx_destroy(&lock);
+    return 0;
+}
@@ -0,0 +1,268 @@
+/*
+ * Microbenchmarks of the threads.h primitives.
+ *
+ * Usage: primitives [threads]
+ *
+ * Single-threaded cases time SAMPLES batches of BATCH operations each;
+ * the batch_* columns are percentiles of the per-batch averages, not of
+ * single operations, since timing those would mostly measure the clock.
+ * Multi-threaded cases report them over all threads' batches, and ns/op
+ * as the wall time divided by the operations of one thread. The mutex
+ * is contended as plain, recursive and timed.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include "threads.h"
+
+#define SAMPLES 2000
+#define BATCH 100
+#define MAX_THREADS 256
+
+struct result {
+    uint64_t samples[SAMPLES * MAX_THREADS];
+    size_t n;
+};
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void
+report(const char *name, int threads, long ops, uint64_t wall_ns, struct result *r)
+{
+    qsort(r->samples, r->n, sizeof(r->samples[0]), cmp_u64);
+    printf("%s,%d,%ld,%.2f,%.2f,%.2f,%.2f\n", name, threads, ops,
+           (double)wall_ns / ops,
+           r->samples[r->n / 2] / (double)BATCH,
+           r->samples[(r->n * 99) / 100] / (double)BATCH,
+           r->samples[r->n - 1] / (double)BATCH);
+    fflush(stdout);
+}
+
+/*------------------------ single thread ------------------------*/
+typedef void (*op_fn)(void *ctx);
+
+static void
+run_single(const char *name, op_fn setup, op_fn op, op_fn teardown, void *ctx)
+{
+    static struct result r;
+    uint64_t start, t0;
+    int s, i;
+
+    if (setup)
+        setup(ctx);
+    for (i = 0; i < BATCH * 10; i++)  // warm up
+        op(ctx);
+    r.n = 0;
+    start = thrd_clock_now();
+    for (s = 0; s < SAMPLES; s++) {
+        t0 = thrd_clock_now();
+        for (i = 0; i < BATCH; i++)
+            op(ctx);
+        r.samples[r.n++] = thrd_clock_now() - t0;
+    }
+    report(name, 1, (long)SAMPLES * BATCH, thrd_clock_now() - start, &r);
+    if (teardown)
+        teardown(ctx);
+}
+
+static mtx_t mtx;
+static void mtx_plain_setup(void *ctx) { (void)ctx; mtx_init(&mtx, mtx_plain); }
+static void mtx_recursive_setup(void *ctx) { (void)ctx; mtx_init(&mtx, mtx_plain | mtx_recursive); }
+static void mtx_timed_setup(void *ctx) { (void)ctx; mtx_init(&mtx, mtx_timed); }
+static void mtx_teardown(void *ctx) { (void)ctx; mtx_destroy(&mtx); }
+static void mtx_lock_op(void *ctx) { (void)ctx; mtx_lock(&mtx); mtx_unlock(&mtx); }
+
+static struct timespec far_future;
+static void mtx_timedlock_op(void *ctx)
+{
+    (void)ctx;
+    mtx_timedlock(&mtx, &far_future);
+    mtx_unlock(&mtx);
+}
+
+static void mtx_held_setup(void *ctx) { mtx_plain_setup(ctx); mtx_lock(&mtx); }
+static void mtx_held_teardown(void *ctx) { mtx_unlock(&mtx); mtx_teardown(ctx); }
+static void mtx_trylock_fail_op(void *ctx) { (void)ctx; mtx_trylock(&mtx); }
+
+static tss_t key;
+static void tss_setup(void *ctx) { (void)ctx; tss_create(&key, NULL); tss_set(key, &key); }
+static void tss_teardown(void *ctx) { (void)ctx; tss_delete(key); }
+static void tss_get_op(void *ctx) { *(void * volatile *)ctx = tss_get(key); }
+static void tss_set_op(void *ctx) { (void)ctx; tss_set(key, &key); }
+
+static once_flag once = ONCE_FLAG_INIT;
+static void once_fn(void) { }
+static void call_once_op(void *ctx) { (void)ctx; call_once(&once, once_fn); }
+
+static void timespec_utc_op(void *ctx) { timespec_get((struct timespec *)ctx, TIME_UTC); }
+static void timespec_mono_op(void *ctx) { timespec_get((struct timespec *)ctx, TIME_MONOTONIC); }
+static void timespec_thread_op(void *ctx) { timespec_get((struct timespec *)ctx, TIME_THREAD_ACTIVE); }
+static void clock_now_op(void *ctx) { *(volatile uint64_t *)ctx = thrd_clock_now(); }
+
+static int thrd_noop(void *arg) { (void)arg; return 0; }
+static void thrd_create_join_op(void *ctx)
+{
+    thrd_t t;
+    (void)ctx;
+    if (thrd_create(&t, thrd_noop, NULL) == thrd_success)
+        thrd_join(t, NULL);
+}
+
+/*------------------------ multi thread ------------------------*/
+struct worker {
+    thrd_t thr;
+    int id;
+    uint64_t *samples;
+};
+
+static int nthreads;
+static struct worker workers[MAX_THREADS];
+static struct result mt_result;
+static volatile int go;
+static void (*mt_op)(int id);
+
+static int
+mt_worker(void *arg)
+{
+    struct worker *w = (struct worker *)arg;
+    int s, i;
+    while (!__atomic_load_n(&go, __ATOMIC_ACQUIRE))
+        thrd_yield();
+    for (s = 0; s < SAMPLES; s++) {
+        uint64_t t0 = thrd_clock_now();
+        for (i = 0; i < BATCH; i++)
+            mt_op(w->id);
+        w->samples[s] = thrd_clock_now() - t0;
+    }
+    return 0;
+}
+
+static void
+run_multi(const char *name, int n, void (*op)(int id))
+{
+    uint64_t start;
+    int i;
+
+    mt_op = op;
+    go = 0;
+    for (i = 0; i < n; i++) {
+        workers[i].id = i;
+        workers[i].samples = &mt_result.samples[(size_t)i * SAMPLES];
+        thrd_create(&workers[i].thr, mt_worker, &workers[i]);
+    }
+    start = thrd_clock_now();
+    __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < n; i++)
+        thrd_join(workers[i].thr, NULL);
+    mt_result.n = (size_t)n * SAMPLES;
+    report(name, n, (long)SAMPLES * BATCH, thrd_clock_now() - start, &mt_result);
+}
+
+static void contended_lock_op(int id) { (void)id; mtx_lock(&mtx); mtx_unlock(&mtx); }
+static void contended_timedlock_op(int id) { (void)id; mtx_timedlock(&mtx, &far_future); mtx_unlock(&mtx); }
+
+/*
+ * cnd_signal() ping-pong: two threads hand a turn back and forth, one
+ * operation is one hand-off.
+ */
+static cnd_t cnd;
+static int turn;
+
+static void
+ping_pong_op(int id)
+{
+    mtx_lock(&mtx);
+    while (turn != id)
+        cnd_wait(&cnd, &mtx);
+    turn = !id;
+    cnd_signal(&cnd);
+    mtx_unlock(&mtx);
+}
+
+/*
+ * cnd_broadcast() fan-out: thread 0 bumps a generation and broadcasts,
+ * then waits until all other threads have seen it.
+ */
+static unsigned long generation;
+static int seen;
+static cnd_t done_cnd;
+
+static void
+fan_out_op(int id)
+{
+    mtx_lock(&mtx);
+    if (id == 0) {
+        generation++;
+        seen = 0;
+        cnd_broadcast(&cnd);
+        while (seen < nthreads - 1)
+            cnd_wait(&done_cnd, &mtx);
+    } else {
+        static __thread unsigned long my_generation;
+        while (generation == my_generation)
+            cnd_wait(&cnd, &mtx);
+        my_generation = generation;
+        if (++seen == nthreads - 1)
+            cnd_signal(&done_cnd);
+    }
+    mtx_unlock(&mtx);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct timespec ts;
+    void *sink;
+    uint64_t clock_sink;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    nthreads = argc > 1 ? atoi(argv[1]) : (int)ncpu;
+    if (nthreads < 2)
+        nthreads = 2;
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+    timespec_get(&far_future, TIME_UTC);
+    far_future.tv_sec += 3600;
+    thrd_clock_calibrate();  // outside the measurement
+
+    printf("benchmark,threads,ops_per_thread,ns_per_op,batch_p50_ns,batch_p99_ns,batch_max_ns\n");
+    run_single("mtx_lock_plain", mtx_plain_setup, mtx_lock_op, mtx_teardown, NULL);
+    run_single("mtx_lock_recursive", mtx_recursive_setup, mtx_lock_op, mtx_teardown, NULL);
+    run_single("mtx_lock_timed", mtx_timed_setup, mtx_lock_op, mtx_teardown, NULL);
+    run_single("mtx_timedlock", mtx_timed_setup, mtx_timedlock_op, mtx_teardown, NULL);
+    run_single("mtx_trylock_fail", mtx_held_setup, mtx_trylock_fail_op, mtx_held_teardown, NULL);
+    run_single("tss_get", tss_setup, tss_get_op, tss_teardown, &sink);
+    run_single("tss_set", tss_setup, tss_set_op, tss_teardown, NULL);
+    run_single("call_once", NULL, call_once_op, NULL, NULL);
+    run_single("timespec_get_utc", NULL, timespec_utc_op, NULL, &ts);
+    run_single("timespec_get_monotonic", NULL, timespec_mono_op, NULL, &ts);
+    run_single("timespec_get_thread_active", NULL, timespec_thread_op, NULL, &ts);
+    run_single("thrd_clock_now", NULL, clock_now_op, NULL, &clock_sink);
+    run_single("thrd_create_join", NULL, thrd_create_join_op, NULL, NULL);
+
+    mtx_plain_setup(NULL);
+    run_multi("mtx_lock_contended", nthreads, contended_lock_op);
+    mtx_teardown(NULL);
+    mtx_recursive_setup(NULL);
+    run_multi("mtx_lock_recursive_contended", nthreads, contended_lock_op);
+    mtx_teardown(NULL);
+    mtx_timed_setup(NULL);
+    run_multi("mtx_timedlock_contended", nthreads, contended_timedlock_op);
+    mtx_teardown(NULL);
+
+    mtx_init(&mtx, mtx_plain);
+    cnd_init(&cnd);
+    cnd_init(&done_cnd);
+    turn = 0;
+    run_multi("cnd_signal_ping_pong", 2, ping_pong_op);
+    run_multi("cnd_broadcast_fan_out", nthreads, fan_out_op);
+    cnd_destroy(&done_cnd);
+    cnd_destroy(&cnd);
+    mtx_destroy(&mtx);
+    return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * Throughput of the queue primitives against the usual ring buffer
+ * guarded by one mtx_t and two cnd_t.
+ *
+ * Usage: queues [max_threads_per_side] [items]
+ *
+ * Every producer pushes its share of the items, every consumer pops
+ * until all of them have arrived. Reported is the item rate over the
+ * wall time of the whole transfer.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include "threads.h"
+#include "mpmc_queue.h"
+#include "spsc_ring.h"
+#include "bqueue.h"
+
+#define CAPACITY 1024
+#define MAX_THREADS 64
+#define BATCH 32
+
+/*---------------------- mutex-guarded ring ----------------------*/
+struct locked_ring {
+    mtx_t mtx;
+    cnd_t not_empty, not_full;
+    void *items[CAPACITY];
+    unsigned head, count;
+};
+
+static void
+locked_init(struct locked_ring *r)
+{
+    mtx_init(&r->mtx, mtx_plain);
+    cnd_init(&r->not_empty);
+    cnd_init(&r->not_full);
+    r->head = r->count = 0;
+}
+
+static void
+locked_destroy(struct locked_ring *r)
+{
+    cnd_destroy(&r->not_full);
+    cnd_destroy(&r->not_empty);
+    mtx_destroy(&r->mtx);
+}
+
+static void
+locked_push(struct locked_ring *r, void *item)
+{
+    mtx_lock(&r->mtx);
+    while (r->count == CAPACITY)
+        cnd_wait(&r->not_full, &r->mtx);
+    r->items[(r->head + r->count++) % CAPACITY] = item;
+    cnd_signal(&r->not_empty);
+    mtx_unlock(&r->mtx);
+}
+
+static void *
+locked_pop(struct locked_ring *r)
+{
+    void *item;
+    mtx_lock(&r->mtx);
+    while (r->count == 0)
+        cnd_wait(&r->not_empty, &r->mtx);
+    item = r->items[r->head];
+    r->head = (r->head + 1) % CAPACITY;
+    r->count--;
+    cnd_signal(&r->not_full);
+    mtx_unlock(&r->mtx);
+    return item;
+}
+
+/*--------------------------- harness ---------------------------*/
+struct queue_ops {
+    const char *name;
+    void (*init)(void);
+    void (*destroy)(void);
+    void (*push)(void *item);
+    void *(*pop)(void);
+    // batch variants, used instead of push/pop when set
+    size_t (*push_n)(void *const *items, size_t n);
+    size_t (*pop_n)(void **items, size_t max);
+    int spsc;
+};
+
+static struct locked_ring lring;
+static mpmc_queue_t mpmc;
+static spsc_ring_t spsc;
+static bqueue_t bq;
+
+static void l_init(void) { locked_init(&lring); }
+static void l_destroy(void) { locked_destroy(&lring); }
+static void l_push(void *item) { locked_push(&lring, item); }
+static void *l_pop(void) { return locked_pop(&lring); }
+
+static void m_init(void) { mpmc_queue_init(&mpmc, CAPACITY); }
+static void m_destroy(void) { mpmc_queue_destroy(&mpmc); }
+static void m_push(void *item) { mpmc_queue_push(&mpmc, item); }
+static void *m_pop(void) { void *item; mpmc_queue_pop(&mpmc, &item); return item; }
+
+static void s_init(void) { spsc_ring_init(&spsc, CAPACITY, SPSC_RING_BLOCKING); }
+static void sn_init(void) { spsc_ring_init(&spsc, CAPACITY, 0); }
+static void s_destroy(void) { spsc_ring_destroy(&spsc); }
+static void s_push(void *item) { spsc_ring_push(&spsc, item); }
+static void *s_pop(void) { void *item; spsc_ring_pop(&spsc, &item); return item; }
+static size_t s_push_n(void *const *items, size_t n) { return spsc_ring_push_n(&spsc, items, n); }
+static size_t s_pop_n(void **items, size_t max) { return spsc_ring_pop_n(&spsc, items, max); }
+
+static void b_init(void) { bqueue_init(&bq, CAPACITY); }
+static void b_destroy(void) { bqueue_destroy(&bq); }
+static void b_push(void *item) { bqueue_put(&bq, item); }
+static void *b_pop(void) { void *item = NULL; bqueue_take(&bq, &item); return item; }
+static size_t b_pop_n(void **items, size_t max) { return bqueue_take_many(&bq, items, max, NULL); }
+
+static const struct queue_ops queues[] = {
+    { "mtx_cnd_ring", l_init, l_destroy, l_push, l_pop, NULL, NULL, 0 },
+    { "mpmc_queue", m_init, m_destroy, m_push, m_pop, NULL, NULL, 0 },
+    { "spsc_ring", s_init, s_destroy, s_push, s_pop, NULL, NULL, 1 },
+    { "spsc_ring_batch", sn_init, s_destroy, NULL, NULL, s_push_n, s_pop_n, 1 },
+    { "bqueue", b_init, b_destroy, b_push, b_pop, NULL, NULL, 0 },
+    { "bqueue_take_many", b_init, b_destroy, b_push, NULL, NULL, b_pop_n, 0 },
+};
+
+static const struct queue_ops *cur;
+static long per_producer;
+static long per_consumer;
+static volatile int go;
+
+static int
+producer_main(void *arg)
+{
+    long i;
+    (void)arg;
+    while (!__atomic_load_n(&go, __ATOMIC_ACQUIRE))
+        thrd_yield();
+    if (cur->push_n) {
+        void *batch[BATCH];
+        size_t n = 0, done, k;
+        for (i = 1; i <= per_producer; i++) {
+            batch[n++] = (void *)(intptr_t)i;
+            if (n < BATCH && i < per_producer)
+                continue;
+            // the batch ring is non-blocking
+            for (done = 0; done < n; done += k) {
+                k = cur->push_n(batch + done, n - done);
+                if (k == 0)
+                    thrd_yield();
+            }
+            n = 0;
+        }
+        return 0;
+    }
+    for (i = 1; i <= per_producer; i++)
+        cur->push((void *)(intptr_t)i);
+    return 0;
+}
+
+static int
+consumer_main(void *arg)
+{
+    long i;
+    uintptr_t sum = 0;
+    (void)arg;
+    while (!__atomic_load_n(&go, __ATOMIC_ACQUIRE))
+        thrd_yield();
+    if (cur->pop_n) {
+        void *batch[BATCH];
+        size_t n, j;
+        for (i = 0; i < per_consumer; i += (long)n) {
+            // never take more than this consumer's share
+            n = cur->pop_n(batch, per_consumer - i < BATCH ? (size_t)(per_consumer - i) : BATCH);
+            if (n == 0)
+                thrd_yield();
+            for (j = 0; j < n; j++)
+                sum += (uintptr_t)batch[j];
+        }
+        return (int)(sum & 1);
+    }
+    for (i = 0; i < per_consumer; i++)
+        sum += (uintptr_t)cur->pop();
+    return (int)(sum & 1);
+}
+
+static double
+run(const struct queue_ops *q, int producers, int consumers, long items)
+{
+    thrd_t thr[2 * MAX_THREADS];
+    struct timespec t0, t1;
+    int i, n = 0;
+
+    cur = q;
+    per_producer = items / producers;
+    per_consumer = per_producer * producers / consumers;
+    q->init();
+    go = 0;
+    for (i = 0; i < producers; i++)
+        thrd_create(&thr[n++], producer_main, NULL);
+    for (i = 0; i < consumers; i++)
+        thrd_create(&thr[n++], consumer_main, NULL);
+    timespec_get(&t0, TIME_MONOTONIC);
+    __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < n; i++)
+        thrd_join(thr[i], NULL);
+    timespec_get(&t1, TIME_MONOTONIC);
+    q->destroy();
+    return (double)(per_consumer * consumers)
+        / ((double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) * 1e-9);
+}
+
+int
+main(int argc, char **argv)
+{
+    int max = argc > 1 ? atoi(argv[1]) : 4;
+    long items = argc > 2 ? atol(argv[2]) : 2000000;
+    int p, c;
+    size_t q;
+
+    if (max < 1 || max > MAX_THREADS || items < 1) {
+        fprintf(stderr, "usage: %s [max_threads_per_side] [items]\n", argv[0]);
+        return 2;
+    }
+    printf("queue,producers,consumers,mitems_per_sec\n");
+    for (p = 1; p <= max; p *= 2) {
+        for (c = 1; c <= max; c *= 2) {
+            // the split must come out even
+            if ((items / p) * p % c)
+                continue;
+            for (q = 0; q < sizeof(queues) / sizeof(queues[0]); q++) {
+                if (queues[q].spsc && (p != 1 || c != 1))
+                    continue;
+                printf("%s,%d,%d,%.2f\n", queues[q].name, p, c,
+                       run(&queues[q], p, c, items) / 1e6);
+                fflush(stdout);
+            }
+        }
+    }
+    return 0;
+}
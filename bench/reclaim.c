@@ -0,0 +1,190 @@
+/*
+ * Read-side cost of epoch-based reclamation against hazard pointers.
+ *
+ * Usage: reclaim [readers] [ms]
+ *
+ * A table of SLOTS pointers to immutable records is read in full by
+ * every reader operation while one writer keeps replacing records and
+ * retiring the old ones. EBR protects a whole operation with one
+ * enter/exit pair; hazard pointers publish and re-check every record
+ * loaded. Reported are operations and replacements per second and the
+ * records still awaiting reclamation at the end of the run.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "threads.h"
+#include "ebr.h"
+#include "hazptr.h"
+
+#define SLOTS 64
+#define MAX_THREADS 64
+
+// the reclamation headers are not first, as in most real structures
+struct record {
+    long value;
+    union {
+        struct ebr_obj ebr;
+        struct hazptr_obj hazptr;
+    } u;
+};
+
+#define record_of(ptr, member) \
+    ((struct record *)((char *)(ptr) - offsetof(struct record, member)))
+
+static struct record *table[SLOTS];
+static ebr_domain_t ebr;
+static hazptr_domain_t hp;
+static long live;
+static volatile int stop;
+
+static struct record *
+record_new(long value)
+{
+    struct record *r = (struct record *)malloc(sizeof(*r));
+    r->value = value;
+    __atomic_add_fetch(&live, 1, __ATOMIC_RELAXED);
+    return r;
+}
+
+static void
+record_free(struct record *r)
+{
+    __atomic_sub_fetch(&live, 1, __ATOMIC_RELAXED);
+    free(r);
+}
+
+static void ebr_free(struct ebr_obj *o) { record_free(record_of(o, u.ebr)); }
+static void hazptr_free(struct hazptr_obj *o) { record_free(record_of(o, u.hazptr)); }
+
+/*---------------------------- schemes ----------------------------*/
+static long
+read_ebr(void)
+{
+    long sum = 0;
+    int i;
+    ebr_enter(&ebr);
+    for (i = 0; i < SLOTS; i++)
+        sum += __atomic_load_n(&table[i], __ATOMIC_ACQUIRE)->value;
+    ebr_exit(&ebr);
+    return sum;
+}
+
+static void
+replace_ebr(int slot, struct record *r)
+{
+    struct record *old = __atomic_exchange_n(&table[slot], r, __ATOMIC_ACQ_REL);
+    ebr_retire(&ebr, &old->u.ebr, ebr_free);
+}
+
+static long
+read_hazptr(void)
+{
+    long sum = 0;
+    int i;
+    for (i = 0; i < SLOTS; i++) {
+        struct record *r = (struct record *)hazptr_protect(&hp, 0, (void *const *)&table[i]);
+        sum += r->value;
+    }
+    hazptr_clear(&hp, 0);
+    return sum;
+}
+
+static void
+replace_hazptr(int slot, struct record *r)
+{
+    struct record *old = __atomic_exchange_n(&table[slot], r, __ATOMIC_ACQ_REL);
+    hazptr_retire(&hp, old, &old->u.hazptr, hazptr_free);
+}
+
+struct scheme {
+    const char *name;
+    long (*read)(void);
+    void (*replace)(int slot, struct record *r);
+};
+
+static const struct scheme schemes[] = {
+    { "ebr", read_ebr, replace_ebr },
+    { "hazptr", read_hazptr, replace_hazptr },
+};
+
+/*---------------------------- harness ----------------------------*/
+static const struct scheme *cur;
+static unsigned long reads[MAX_THREADS];
+
+static int
+reader_main(void *arg)
+{
+    unsigned long *count = (unsigned long *)arg, n = 0;
+    long sink = 0;
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        sink += cur->read();
+        n++;
+    }
+    *count = n;
+    return (int)(sink & 1);
+}
+
+static int
+writer_main(void *arg)
+{
+    unsigned long *count = (unsigned long *)arg, n = 0;
+    unsigned seed = 12345;
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        seed = seed * 1103515245u + 12345u;
+        cur->replace((int)((seed >> 16) % SLOTS), record_new((long)n));
+        n++;
+    }
+    *count = n;
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int readers = argc > 1 ? atoi(argv[1]) : 4;
+    long ms = argc > 2 ? atol(argv[2]) : 1000;
+    struct timespec run;
+    size_t s;
+    int i;
+
+    if (readers < 1 || readers > MAX_THREADS || ms <= 0) {
+        fprintf(stderr, "usage: %s [readers] [ms]\n", argv[0]);
+        return 2;
+    }
+    run.tv_sec = ms / 1000;
+    run.tv_nsec = (ms % 1000) * 1000000;
+
+    printf("scheme,readers,reads_per_sec,replacements_per_sec,unreclaimed\n");
+    for (s = 0; s < sizeof(schemes) / sizeof(schemes[0]); s++) {
+        thrd_t thr[MAX_THREADS + 1];
+        unsigned long total = 0, writes = 0;
+
+        cur = &schemes[s];
+        ebr_domain_init(&ebr);
+        hazptr_domain_init(&hp);
+        for (i = 0; i < SLOTS; i++)
+            table[i] = record_new(i);
+        stop = 0;
+        for (i = 0; i < readers; i++)
+            thrd_create(&thr[i], reader_main, &reads[i]);
+        thrd_create(&thr[readers], writer_main, &writes);
+        thrd_sleep(&run, NULL);
+        __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+        for (i = 0; i <= readers; i++)
+            thrd_join(thr[i], NULL);
+        for (i = 0; i < readers; i++)
+            total += reads[i];
+
+        printf("%s,%d,%.0f,%.0f,%ld\n", cur->name, readers,
+               total * 1000.0 / ms, writes * 1000.0 / ms, live - SLOTS);
+        fflush(stdout);
+
+        ebr_domain_destroy(&ebr);
+        hazptr_domain_destroy(&hp);
+        for (i = 0; i < SLOTS; i++)
+            record_free(table[i]);
+    }
+    return 0;
+}
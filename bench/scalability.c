@@ -0,0 +1,349 @@
+/*
+ * Scalability sweep: runs each registered workload with 1..N threads,
+ * pinned either compactly (fill SMT siblings and cores of one socket
+ * first) or spread (one thread per socket, then per core, SMT siblings
+ * last).
+ *
+ * Usage: scalability [max_threads] [ms_per_point]
+ *
+ * Prints one CSV row per workload, placement and thread count, with the
+ * throughput, the spread of per-thread operation counts and the CPU
+ * utilisation of the process.
+ */
+#define _GNU_SOURCE
+/* glibc declares both under _GNU_SOURCE; only thrd_clock_now() is used */
+#define HAVE_TIMESPEC_GET
+#define HAVE_TIMESPEC_GETRES
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/resource.h>
+#include "threads.h"
+
+#define MAX_THREADS 256
+
+/*------------------------ CPU placement ------------------------*/
+struct cpu {
+    int id;
+    int package;
+    int core;
+    int smt;  // index among the hardware threads of its core
+};
+
+static struct cpu cpus[MAX_THREADS];
+static int ncpus;
+
+static int
+read_int(const char *fmt, int cpu)
+{
+    char path[128];
+    FILE *f;
+    int v = 0;
+    snprintf(path, sizeof(path), fmt, cpu);
+    f = fopen(path, "r");
+    if (!f)
+        return 0;
+    if (fscanf(f, "%d", &v) != 1)
+        v = 0;
+    fclose(f);
+    return v;
+}
+
+static int
+cmp_compact(const void *a, const void *b)
+{
+    const struct cpu *x = (const struct cpu *)a, *y = (const struct cpu *)b;
+    if (x->package != y->package)
+        return x->package - y->package;
+    if (x->core != y->core)
+        return x->core - y->core;
+    return x->id - y->id;
+}
+
+static int
+cmp_spread(const void *a, const void *b)
+{
+    const struct cpu *x = (const struct cpu *)a, *y = (const struct cpu *)b;
+    if (x->smt != y->smt)
+        return x->smt - y->smt;
+    if (x->core != y->core)
+        return x->core - y->core;
+    return x->package - y->package;
+}
+
+static void
+topology_init(void)
+{
+    cpu_set_t set;
+    int i, j;
+
+    CPU_ZERO(&set);
+    sched_getaffinity(0, sizeof(set), &set);
+    for (i = 0; i < CPU_SETSIZE && ncpus < MAX_THREADS; i++) {
+        if (!CPU_ISSET(i, &set))
+            continue;
+        cpus[ncpus].id = i;
+        cpus[ncpus].package = read_int("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", i);
+        cpus[ncpus].core = read_int("/sys/devices/system/cpu/cpu%d/topology/core_id", i);
+        ncpus++;
+    }
+    for (i = 0; i < ncpus; i++) {
+        cpus[i].smt = 0;
+        for (j = 0; j < i; j++)
+            if (cpus[j].package == cpus[i].package && cpus[j].core == cpus[i].core)
+                cpus[i].smt++;
+    }
+}
+
+static void
+pin(int slot)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[slot % ncpus].id, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+/*-------------------------- workloads --------------------------*/
+struct workload {
+    const char *name;
+    void (*init)(int nthreads);
+    void (*op)(int id, int nthreads);
+    void (*stop)(void);  // wake up threads blocked in op()
+    void (*fini)(void);
+};
+
+static volatile int stop;
+
+/* counter under lock */
+static mtx_t counter_mtx;
+static unsigned long counter;
+static void counter_init(int n) { (void)n; mtx_init(&counter_mtx, mtx_plain); counter = 0; }
+static void counter_op(int id, int n) { (void)id; (void)n; mtx_lock(&counter_mtx); counter++; mtx_unlock(&counter_mtx); }
+static void counter_fini(void) { mtx_destroy(&counter_mtx); }
+
+/* producer/consumer over a bounded buffer; even ids produce, odd ones consume */
+#define PC_SIZE 256
+static mtx_t pc_mtx;
+static cnd_t pc_not_empty, pc_not_full;
+static unsigned long pc_buf[PC_SIZE];
+static unsigned pc_head, pc_count;
+
+static void
+pc_init(int n)
+{
+    (void)n;
+    mtx_init(&pc_mtx, mtx_plain);
+    cnd_init(&pc_not_empty);
+    cnd_init(&pc_not_full);
+    pc_head = pc_count = 0;
+}
+
+static void
+pc_put(unsigned long v)
+{
+    mtx_lock(&pc_mtx);
+    while (pc_count == PC_SIZE && !stop)
+        cnd_wait(&pc_not_full, &pc_mtx);
+    if (pc_count < PC_SIZE) {
+        pc_buf[(pc_head + pc_count++) % PC_SIZE] = v;
+        cnd_signal(&pc_not_empty);
+    }
+    mtx_unlock(&pc_mtx);
+}
+
+static void
+pc_take(void)
+{
+    mtx_lock(&pc_mtx);
+    while (pc_count == 0 && !stop)
+        cnd_wait(&pc_not_empty, &pc_mtx);
+    if (pc_count > 0) {
+        pc_head = (pc_head + 1) % PC_SIZE;
+        pc_count--;
+        cnd_signal(&pc_not_full);
+    }
+    mtx_unlock(&pc_mtx);
+}
+
+static void
+pc_op(int id, int n)
+{
+    if (n == 1) {
+        pc_put((unsigned long)id);
+        pc_take();
+    } else if (id % 2 == 0) {
+        pc_put((unsigned long)id);
+    } else {
+        pc_take();
+    }
+}
+
+static void
+pc_stop(void)
+{
+    mtx_lock(&pc_mtx);
+    cnd_broadcast(&pc_not_empty);
+    cnd_broadcast(&pc_not_full);
+    mtx_unlock(&pc_mtx);
+}
+
+static void
+pc_fini(void)
+{
+    cnd_destroy(&pc_not_full);
+    cnd_destroy(&pc_not_empty);
+    mtx_destroy(&pc_mtx);
+}
+
+/* read-mostly table: 1 in 32 operations is an update */
+#define TABLE_SIZE 1024
+static mtx_t table_mtx;
+static unsigned long table[TABLE_SIZE];
+static void table_init(int n) { (void)n; mtx_init(&table_mtx, mtx_plain); }
+static void table_fini(void) { mtx_destroy(&table_mtx); }
+
+static void
+table_op(int id, int n)
+{
+    static __thread unsigned long rng;
+    volatile unsigned long sink;
+    unsigned i;
+    (void)n;
+    rng = rng * 6364136223846793005ul + 1442695040888963407ul + (unsigned long)id;
+    i = (unsigned)(rng >> 33) % TABLE_SIZE;
+    mtx_lock(&table_mtx);
+    if ((rng >> 20) % 32 == 0)
+        table[i]++;
+    else
+        sink = table[i];
+    mtx_unlock(&table_mtx);
+    (void)sink;
+}
+
+static const struct workload workloads[] = {
+    { "counter", counter_init, counter_op, NULL, counter_fini },
+    { "producer_consumer", pc_init, pc_op, pc_stop, pc_fini },
+    { "read_mostly_table", table_init, table_op, NULL, table_fini },
+};
+
+/*--------------------------- harness ---------------------------*/
+struct worker {
+    thrd_t thr;
+    int id;
+    int slot;
+    int nthreads;
+    const struct workload *w;
+    unsigned long ops;
+    char pad[64];
+};
+
+static struct worker workers[MAX_THREADS];
+static volatile int go;
+
+static int
+worker_main(void *arg)
+{
+    struct worker *wk = (struct worker *)arg;
+    unsigned long ops = 0;
+    pin(wk->slot);
+    while (!__atomic_load_n(&go, __ATOMIC_ACQUIRE))
+        thrd_yield();
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        wk->w->op(wk->id, wk->nthreads);
+        ops++;
+    }
+    wk->ops = ops;
+    return 0;
+}
+
+static double
+cpu_seconds(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+         + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static void
+run_point(const struct workload *w, const char *placement, int n, long ms)
+{
+    struct timespec d = { ms / 1000, (ms % 1000) * 1000000 };
+    unsigned long total = 0, min = (unsigned long)-1, max = 0;
+    double mean, var = 0, secs, cpu0, cpu1;
+    uint64_t t0, t1;
+    int i;
+
+    w->init(n);
+    go = 0;
+    stop = 0;
+    for (i = 0; i < n; i++) {
+        workers[i].id = i;
+        workers[i].slot = i;
+        workers[i].nthreads = n;
+        workers[i].w = w;
+        workers[i].ops = 0;
+        thrd_create(&workers[i].thr, worker_main, &workers[i]);
+    }
+    cpu0 = cpu_seconds();
+    t0 = thrd_clock_now();
+    __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+    thrd_sleep(&d, NULL);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    if (w->stop)
+        w->stop();
+    for (i = 0; i < n; i++)
+        thrd_join(workers[i].thr, NULL);
+    t1 = thrd_clock_now();
+    cpu1 = cpu_seconds();
+    w->fini();
+
+    for (i = 0; i < n; i++) {
+        total += workers[i].ops;
+        if (workers[i].ops < min)
+            min = workers[i].ops;
+        if (workers[i].ops > max)
+            max = workers[i].ops;
+    }
+    mean = (double)total / n;
+    for (i = 0; i < n; i++)
+        var += (workers[i].ops - mean) * (workers[i].ops - mean);
+    secs = (t1 - t0) / 1e9;
+    printf("%s,%s,%d,%.0f,%.3f,%.3f,%.3f\n", w->name, placement, n,
+           total / secs,
+           max ? (double)min / max : 0.0,
+           mean > 0 ? sqrt(var / n) / mean : 0.0,
+           (cpu1 - cpu0) / (secs * (n < ncpus ? n : ncpus)));
+    fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        int (*cmp)(const void *, const void *);
+    } placements[] = { { "compact", cmp_compact }, { "spread", cmp_spread } };
+    int max_threads, p, n;
+    size_t i;
+    long ms;
+
+    topology_init();
+    max_threads = argc > 1 ? atoi(argv[1]) : ncpus;
+    ms = argc > 2 ? atol(argv[2]) : 500;
+    if (max_threads < 1 || max_threads > MAX_THREADS)
+        max_threads = ncpus;
+    thrd_clock_calibrate();  // outside the measurement
+
+    printf("workload,placement,threads,ops_per_sec,min_max_ratio,ops_cv,cpu_util\n");
+    for (i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        for (p = 0; p < 2; p++) {
+            qsort(cpus, (size_t)ncpus, sizeof(cpus[0]), placements[p].cmp);
+            for (n = 1; n <= max_threads; n++)
+                run_point(&workloads[i], placements[p].name, n, ms);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+/*
+ * Oversleep distribution of thrd_sleep() versus thrd_sleep_precise().
+ *
+ * Usage: sleep_precision [samples]
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include "threads.h"
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void
+run(const char *mode, int precise, long usec, uint64_t *samples, int n)
+{
+    struct timespec d = { 0, usec * 1000 };
+    int i;
+
+    for (i = 0; i < n; i++) {
+        uint64_t t0 = thrd_clock_now(), t1;
+        if (precise)
+            thrd_sleep_precise(&d);
+        else
+            thrd_sleep(&d, NULL);
+        t1 = thrd_clock_now();
+        samples[i] = t1 - t0 > (uint64_t)d.tv_nsec ? t1 - t0 - (uint64_t)d.tv_nsec : 0;
+    }
+    qsort(samples, (size_t)n, sizeof(*samples), cmp_u64);
+    printf("%s,%ld,%.2f,%.2f,%.2f\n", mode, usec,
+           samples[n / 2] / 1e3, samples[(n * 99) / 100] / 1e3, samples[n - 1] / 1e3);
+}
+
+int
+main(int argc, char **argv)
+{
+    static const long durations[] = { 20, 50, 100, 500 };
+    int n = argc > 1 ? atoi(argv[1]) : 2000;
+    uint64_t *samples;
+    size_t i;
+
+    if (n <= 0)
+        return 1;
+    samples = malloc(sizeof(*samples) * (size_t)n);
+    if (!samples)
+        return 1;
+    thrd_clock_calibrate();  // outside the measurement
+    printf("mode,duration_us,p50_us,p99_us,max_us\n");
+    // thrd_sleep_precise() lowers the timer slack of the thread for good,
+    // so all plain sleeps go first
+    for (i = 0; i < sizeof(durations) / sizeof(durations[0]); i++)
+        run("thrd_sleep", 0, durations[i], samples, n);
+    for (i = 0; i < sizeof(durations) / sizeof(durations[0]); i++)
+        run("thrd_sleep_precise", 1, durations[i], samples, n);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,419 @@
+/*
+ * Open-loop tail latency of lock acquisitions, condvar wake-ups and
+ * task hand-offs to a worker pool.
+ *
+ * Usage: tail_latency [threads] [ops_per_sec_per_thread] [ms]
+ *
+ * Every generator thread issues operations on a fixed schedule. Latency
+ * is measured from the scheduled start, not the actual one, so time an
+ * operation spends queued behind a slow predecessor is counted instead
+ * of silently skipped (coordinated omission). The uncorrected service
+ * time is printed alongside for comparison. Generators sleep until each
+ * scheduled start with minimal timer slack, so their own wake-up delay
+ * is part of the corrected latency.
+ *
+ * The lock cases compare the plain mtx_t against a FIFO ticket lock
+ * built on the same condvar primitives, to show what fairness does to
+ * the tail.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "threads.h"
+
+#define MAX_THREADS 64
+
+/*------------------- log-linear histogram -------------------*/
+/* 32 sub-buckets per power of two: values within ~3% */
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+static unsigned
+hist_bucket(uint64_t v)
+{
+    unsigned e;
+    if (v < HIST_SUB)
+        return (unsigned)v;
+    e = 63 - (unsigned)__builtin_clzll(v);
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB
+        + (unsigned)((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+static uint64_t
+hist_value(unsigned b)
+{
+    unsigned e, sub;
+    if (b < HIST_SUB)
+        return b;
+    e = b / HIST_SUB + HIST_SUB_BITS - 1;
+    sub = b % HIST_SUB;
+    return (((uint64_t)(HIST_SUB + sub + 1)) << (e - HIST_SUB_BITS)) - 1;
+}
+
+static void
+hist_record(struct hist *h, uint64_t v)
+{
+    h->buckets[hist_bucket(v)]++;
+    h->count++;
+    if (v > h->max)
+        h->max = v;
+}
+
+static void
+hist_merge(struct hist *dst, const struct hist *src)
+{
+    unsigned b;
+    for (b = 0; b < HIST_BUCKETS; b++)
+        dst->buckets[b] += src->buckets[b];
+    dst->count += src->count;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+static double
+hist_percentile(const struct hist *h, double q)
+{
+    uint64_t rank = (uint64_t)(q * (double)h->count + 0.5), seen = 0;
+    unsigned b;
+    if (rank == 0)
+        rank = 1;
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank)
+            return hist_value(b) < h->max ? (double)hist_value(b) : (double)h->max;
+    }
+    return (double)h->max;
+}
+
+/*------------------------- FIFO lock -------------------------*/
+struct ticket_lock {
+    mtx_t mtx;
+    cnd_t cnd;
+    unsigned long next, serving;
+};
+
+static void
+ticket_init(struct ticket_lock *l)
+{
+    mtx_init(&l->mtx, mtx_plain);
+    cnd_init(&l->cnd);
+    l->next = l->serving = 0;
+}
+
+static void
+ticket_lock(struct ticket_lock *l)
+{
+    unsigned long me;
+    mtx_lock(&l->mtx);
+    me = l->next++;
+    while (l->serving != me)
+        cnd_wait(&l->cnd, &l->mtx);
+    mtx_unlock(&l->mtx);
+}
+
+static void
+ticket_unlock(struct ticket_lock *l)
+{
+    mtx_lock(&l->mtx);
+    l->serving++;
+    cnd_broadcast(&l->cnd);
+    mtx_unlock(&l->mtx);
+}
+
+static void
+ticket_destroy(struct ticket_lock *l)
+{
+    cnd_destroy(&l->cnd);
+    mtx_destroy(&l->mtx);
+}
+
+/*------------------------ operations ------------------------*/
+struct gen {
+    thrd_t thr;
+    int id;
+    struct hist corrected;
+    struct hist raw;
+};
+
+static struct gen gens[MAX_THREADS];
+static int nthreads;
+static uint64_t interval_ns, run_ns;
+static volatile unsigned long shared_data[16];  // guarded by the lock under test
+
+static void
+critical_section(volatile unsigned long *data)
+{
+    int i;
+    for (i = 0; i < 16; i++)
+        data[i]++;
+}
+
+static mtx_t lock_mtx;
+static struct ticket_lock lock_ticket;
+
+static void op_mtx(int id) { (void)id; mtx_lock(&lock_mtx); critical_section(shared_data); mtx_unlock(&lock_mtx); }
+static void op_ticket(int id) { (void)id; ticket_lock(&lock_ticket); critical_section(shared_data); ticket_unlock(&lock_ticket); }
+
+/* condvar wake-up: each generator wakes its own partner and waits for the ack */
+struct partner {
+    thrd_t thr;
+    mtx_t mtx;
+    cnd_t cnd;
+    unsigned long seq;
+    unsigned long ack;
+    int quit;
+};
+
+static struct partner partners[MAX_THREADS];
+
+static int
+partner_main(void *arg)
+{
+    struct partner *p = (struct partner *)arg;
+    unsigned long seen = 0;
+    mtx_lock(&p->mtx);
+    for (;;) {
+        while (p->seq == seen && !p->quit)
+            cnd_wait(&p->cnd, &p->mtx);
+        if (p->quit)
+            break;
+        seen = p->seq;
+        __atomic_store_n(&p->ack, seen, __ATOMIC_RELEASE);
+    }
+    mtx_unlock(&p->mtx);
+    return 0;
+}
+
+static void
+op_cnd(int id)
+{
+    struct partner *p = &partners[id];
+    unsigned long seq;
+    mtx_lock(&p->mtx);
+    seq = ++p->seq;
+    cnd_signal(&p->cnd);
+    mtx_unlock(&p->mtx);
+    while (__atomic_load_n(&p->ack, __ATOMIC_ACQUIRE) != seq)
+        thrd_yield();
+}
+
+/*
+ * task submission: latency is recorded by the worker that picks the task
+ * up. A full queue blocks the generator, whose later tasks then count
+ * the delay against their schedule.
+ */
+#define QUEUE_SIZE 4096
+struct task {
+    uint64_t intended;
+    uint64_t submitted;
+    int gen;
+};
+
+static mtx_t q_mtx;
+static cnd_t q_cnd;
+static cnd_t q_room;
+static struct task queue[QUEUE_SIZE];
+static unsigned q_head, q_count;
+static int q_quit;
+static thrd_t pool[MAX_THREADS];
+static struct hist pool_corrected[MAX_THREADS], pool_raw[MAX_THREADS];
+static volatile unsigned long pool_data[MAX_THREADS][16];
+static __thread uint64_t current_intended;
+
+static int
+pool_main(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    mtx_lock(&q_mtx);
+    for (;;) {
+        struct task t;
+        uint64_t now;
+        while (q_count == 0 && !q_quit)
+            cnd_wait(&q_cnd, &q_mtx);
+        if (q_count == 0)
+            break;
+        t = queue[q_head];
+        q_head = (q_head + 1) % QUEUE_SIZE;
+        if (q_count-- == QUEUE_SIZE)
+            cnd_broadcast(&q_room);
+        mtx_unlock(&q_mtx);
+        now = thrd_clock_now();
+        hist_record(&pool_corrected[id], now - t.intended);
+        hist_record(&pool_raw[id], now - t.submitted);
+        critical_section(pool_data[id]);
+        mtx_lock(&q_mtx);
+    }
+    mtx_unlock(&q_mtx);
+    return 0;
+}
+
+static void
+op_submit(int id)
+{
+    struct task t;
+    t.intended = current_intended;
+    t.submitted = thrd_clock_now();
+    t.gen = id;
+    mtx_lock(&q_mtx);
+    while (q_count == QUEUE_SIZE)
+        cnd_wait(&q_room, &q_mtx);
+    queue[(q_head + q_count++) % QUEUE_SIZE] = t;
+    cnd_signal(&q_cnd);
+    mtx_unlock(&q_mtx);
+}
+
+/*-------------------------- harness --------------------------*/
+static void (*gen_op)(int id);
+static int gen_records;  // 0 when the pool records latencies itself
+static volatile int go;
+
+static int
+gen_main(void *arg)
+{
+    struct gen *g = (struct gen *)arg;
+    uint64_t start, next, end;
+    unsigned long k;
+
+    thrd_set_timerslack(1);
+    while (!__atomic_load_n(&go, __ATOMIC_ACQUIRE))
+        thrd_yield();
+    // stagger the generators across one interval
+    start = thrd_clock_now() + interval_ns * (uint64_t)g->id / (uint64_t)nthreads;
+    end = start + run_ns;
+    for (k = 0; (next = start + k * interval_ns) < end; k++) {
+        uint64_t t0, t1;
+        if (next > thrd_clock_now()) {
+            // thrd_clock_now() follows CLOCK_MONOTONIC
+            struct timespec d;
+            d.tv_sec = (time_t)(next / 1000000000u);
+            d.tv_nsec = (long)(next % 1000000000u);
+            while (thrd_sleep_until(&d, TIME_MONOTONIC) == -1)
+                ;
+        }
+        current_intended = next;
+        t0 = thrd_clock_now();
+        gen_op(g->id);
+        t1 = thrd_clock_now();
+        if (gen_records) {
+            hist_record(&g->corrected, t1 - next);
+            hist_record(&g->raw, t1 - t0);
+        }
+    }
+    return 0;
+}
+
+static void
+print_row(const char *name, const char *kind, const struct hist *h)
+{
+    printf("%s,%s,%d,%llu,%.0f,%.0f,%.0f,%.0f,%llu\n", name, kind, nthreads,
+           (unsigned long long)h->count,
+           hist_percentile(h, 0.50), hist_percentile(h, 0.99),
+           hist_percentile(h, 0.999), hist_percentile(h, 0.9999),
+           (unsigned long long)h->max);
+}
+
+static void
+run(const char *name, void (*op)(int id), int records)
+{
+    static struct hist corrected, raw;
+    int i;
+
+    gen_op = op;
+    gen_records = records;
+    go = 0;
+    memset(gens, 0, sizeof(gens));
+    for (i = 0; i < nthreads; i++) {
+        gens[i].id = i;
+        thrd_create(&gens[i].thr, gen_main, &gens[i]);
+    }
+    __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < nthreads; i++)
+        thrd_join(gens[i].thr, NULL);
+
+    if (!records)
+        return;
+    memset(&corrected, 0, sizeof(corrected));
+    memset(&raw, 0, sizeof(raw));
+    for (i = 0; i < nthreads; i++) {
+        hist_merge(&corrected, &gens[i].corrected);
+        hist_merge(&raw, &gens[i].raw);
+    }
+    print_row(name, "corrected", &corrected);
+    print_row(name, "service", &raw);
+}
+
+int
+main(int argc, char **argv)
+{
+    static struct hist corrected, raw;
+    long rate, ms;
+    int i;
+
+    nthreads = argc > 1 ? atoi(argv[1]) : 4;
+    rate = argc > 2 ? atol(argv[2]) : 20000;
+    ms = argc > 3 ? atol(argv[3]) : 2000;
+    if (nthreads < 1 || nthreads > MAX_THREADS || rate <= 0 || ms <= 0) {
+        fprintf(stderr, "usage: %s [threads] [ops_per_sec_per_thread] [ms]\n", argv[0]);
+        return 2;
+    }
+    interval_ns = 1000000000u / (uint64_t)rate;
+    run_ns = (uint64_t)ms * 1000000u;
+    thrd_clock_calibrate();  // outside the measurement
+
+    printf("operation,latency,threads,count,p50_ns,p99_ns,p999_ns,p9999_ns,max_ns\n");
+
+    mtx_init(&lock_mtx, mtx_plain);
+    run("mtx_lock", op_mtx, 1);
+    mtx_destroy(&lock_mtx);
+
+    ticket_init(&lock_ticket);
+    run("ticket_lock", op_ticket, 1);
+    ticket_destroy(&lock_ticket);
+
+    for (i = 0; i < nthreads; i++) {
+        memset(&partners[i], 0, sizeof(partners[i]));
+        mtx_init(&partners[i].mtx, mtx_plain);
+        cnd_init(&partners[i].cnd);
+        thrd_create(&partners[i].thr, partner_main, &partners[i]);
+    }
+    run("cnd_wakeup", op_cnd, 1);
+    for (i = 0; i < nthreads; i++) {
+        mtx_lock(&partners[i].mtx);
+        partners[i].quit = 1;
+        cnd_signal(&partners[i].cnd);
+        mtx_unlock(&partners[i].mtx);
+        thrd_join(partners[i].thr, NULL);
+        cnd_destroy(&partners[i].cnd);
+        mtx_destroy(&partners[i].mtx);
+    }
+
+    mtx_init(&q_mtx, mtx_plain);
+    cnd_init(&q_cnd);
+    cnd_init(&q_room);
+    for (i = 0; i < nthreads; i++)
+        thrd_create(&pool[i], pool_main, (void *)(intptr_t)i);
+    run("task_submit", op_submit, 0);
+    mtx_lock(&q_mtx);
+    q_quit = 1;
+    cnd_broadcast(&q_cnd);
+    mtx_unlock(&q_mtx);
+    for (i = 0; i < nthreads; i++) {
+        thrd_join(pool[i], NULL);
+        hist_merge(&corrected, &pool_corrected[i]);
+        hist_merge(&raw, &pool_raw[i]);
+    }
+    print_row("task_submit", "corrected", &corrected);
+    print_row("task_submit", "service", &raw);
+    cnd_destroy(&q_room);
+    cnd_destroy(&q_cnd);
+    mtx_destroy(&q_mtx);
+    return 0;
+}
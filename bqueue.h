@@ -0,0 +1,179 @@
+/*
+ * Blocking bounded queue of pointers on mtx_t and cnd_t.
+ *
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file COPYING)
+ *
+ * The reference work queue: a ring buffer under one mutex with one
+ * condition variable per direction. Producers and consumers only
+ * signal on the empty->non-empty and full->non-full transitions, and
+ * only when somebody waits on the other side; a woken thread passes the
+ * wake-up on if there is work left for another sleeper. Consumers that
+ * drain with bqueue_take_many() thus see batches under one lock
+ * acquisition instead of being woken once per item.
+ *
+ * Timeouts are absolute and based on TIME_UTC, as for cnd_timedwait().
+ */
+#ifndef BQUEUE_H_INCLUDED_
+#define BQUEUE_H_INCLUDED_
+
+#include <stddef.h>
+#include <stdlib.h>
+#include "threads.h"
+
+typedef struct {
+    mtx_t mtx;
+    cnd_t not_empty;
+    cnd_t not_full;
+    void **items;
+    size_t cap;
+    size_t head;
+    size_t count;
+    unsigned takers;   // consumers waiting on not_empty
+    unsigned putters;  // producers waiting on not_full
+} bqueue_t;
+
+static inline int
+bqueue_init(bqueue_t *q, size_t capacity)
+{
+    assert(q != NULL);
+    assert(capacity > 0);
+    q->items = (void **)malloc(capacity * sizeof(q->items[0]));
+    if (!q->items)
+        return thrd_nomem;
+    if (mtx_init(&q->mtx, mtx_plain) != thrd_success)
+        goto err_mtx;
+    if (cnd_init(&q->not_empty) != thrd_success)
+        goto err_not_empty;
+    if (cnd_init(&q->not_full) != thrd_success)
+        goto err_not_full;
+    q->cap = capacity;
+    q->head = 0;
+    q->count = 0;
+    q->takers = 0;
+    q->putters = 0;
+    return thrd_success;
+
+err_not_full:
+    cnd_destroy(&q->not_empty);
+err_not_empty:
+    mtx_destroy(&q->mtx);
+err_mtx:
+    free(q->items);
+    return thrd_error;
+}
+
+static inline void
+bqueue_destroy(bqueue_t *q)
+{
+    assert(q != NULL);
+    cnd_destroy(&q->not_full);
+    cnd_destroy(&q->not_empty);
+    mtx_destroy(&q->mtx);
+    free(q->items);
+}
+
+/*
+ * Wait for room, with q->mtx held; NULL abs_time waits forever.
+ * cnd_timedwait() reports a timeout as thrd_busy in the emulation and
+ * as thrd_timedout natively; both become thrd_timeout here.
+ */
+static inline int
+impl_bqueue_wait_room(bqueue_t *q, const struct timespec *abs_time)
+{
+    int rt = thrd_success;
+    while (q->count == q->cap && rt == thrd_success) {
+        q->putters++;
+        rt = abs_time ? cnd_timedwait(&q->not_full, &q->mtx, abs_time)
+                      : cnd_wait(&q->not_full, &q->mtx);
+        q->putters--;
+    }
+    if (q->count < q->cap)
+        return thrd_success;
+    return rt == thrd_error ? thrd_error : thrd_timeout;
+}
+
+static inline int
+impl_bqueue_wait_items(bqueue_t *q, const struct timespec *abs_time)
+{
+    int rt = thrd_success;
+    while (q->count == 0 && rt == thrd_success) {
+        q->takers++;
+        rt = abs_time ? cnd_timedwait(&q->not_empty, &q->mtx, abs_time)
+                      : cnd_wait(&q->not_empty, &q->mtx);
+        q->takers--;
+    }
+    if (q->count)
+        return thrd_success;
+    return rt == thrd_error ? thrd_error : thrd_timeout;
+}
+
+/* returns thrd_timeout if abs_time passed before there was room */
+static inline int
+bqueue_timedput(bqueue_t *q, void *item, const struct timespec *abs_time)
+{
+    int rt;
+    assert(q != NULL);
+    mtx_lock(&q->mtx);
+    rt = impl_bqueue_wait_room(q, abs_time);
+    if (rt == thrd_success) {
+        q->items[(q->head + q->count) % q->cap] = item;
+        if (q->count++ == 0 && q->takers)
+            cnd_signal(&q->not_empty);
+        // room left for another waiting producer: pass the wake-up on
+        if (q->putters && q->count < q->cap)
+            cnd_signal(&q->not_full);
+    }
+    mtx_unlock(&q->mtx);
+    return rt;
+}
+
+static inline int
+bqueue_put(bqueue_t *q, void *item)
+{
+    return bqueue_timedput(q, item, NULL);
+}
+
+/*
+ * Takes between 1 and max items, waiting until at least one is there.
+ * Returns the number taken, 0 on timeout.
+ */
+static inline size_t
+bqueue_take_many(bqueue_t *q, void **items, size_t max, const struct timespec *abs_time)
+{
+    size_t n = 0, was;
+    assert(q != NULL && items != NULL && max > 0);
+    mtx_lock(&q->mtx);
+    if (impl_bqueue_wait_items(q, abs_time) == thrd_success) {
+        was = q->count;
+        for (; n < max && q->count; n++) {
+            items[n] = q->items[q->head];
+            q->head = (q->head + 1) % q->cap;
+            q->count--;
+        }
+        if (was == q->cap && q->putters)
+            cnd_signal(&q->not_full);
+        // items left for another waiting consumer: pass the wake-up on
+        if (q->count && q->takers)
+            cnd_signal(&q->not_empty);
+    }
+    mtx_unlock(&q->mtx);
+    return n;
+}
+
+static inline int
+bqueue_timedtake(bqueue_t *q, void **item, const struct timespec *abs_time)
+{
+    assert(item != NULL);
+    if (bqueue_take_many(q, item, 1, abs_time) == 1)
+        return thrd_success;
+    return thrd_timeout;
+}
+
+static inline int
+bqueue_take(bqueue_t *q, void **item)
+{
+    return bqueue_timedtake(q, item, NULL);
+}
+
+#endif /* BQUEUE_H_INCLUDED_ */
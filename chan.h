@@ -0,0 +1,534 @@
+/*
+ * Go-style channels of fixed-size elements, with select.
+ *
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file COPYING)
+ *
+ * A channel carries elements of elem_size bytes and buffers up to
+ * capacity of them; capacity 0 makes every send wait for a receiver.
+ * Blocked threads queue on the channel with a pointer to their element
+ * and are completed by their peer: a sender copies straight into a
+ * waiting receiver's element, a receiver straight out of a waiting
+ * sender's, and the woken thread returns without touching the channel
+ * lock again.
+ *
+ * chan_select() waits on several sends and receives at once. Its wait
+ * records are queued on every channel involved; the first peer to claim
+ * the select (a CAS on its shared state) completes it and the other
+ * records are discarded.
+ *
+ * Return values: thrd_success, thrd_error when the channel is closed
+ * (receives return it once the buffer is drained, and zero the
+ * element), thrd_busy from the try variants and thrd_timeout from the
+ * timed ones. Timeouts are absolute and based on TIME_UTC, as for
+ * cnd_timedwait().
+ *
+ * Requires the GCC __atomic builtins.
+ */
+#ifndef CHAN_H_INCLUDED_
+#define CHAN_H_INCLUDED_
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "threads.h"
+
+/*
+Implementation limits:
+  - At most CHAN_SELECT_MAX cases per chan_select()
+*/
+#define CHAN_SELECT_MAX 32
+
+struct impl_chan_ctx {
+    mtx_t mtx;
+    cnd_t cnd;
+    int fired;  // case index once claimed, -1 while waiting
+    int done;
+    int rt;
+};
+
+/* fired value of a select that gave up waiting */
+#define IMPL_CHAN_TIMEDOUT (-2)
+
+/* impl_chan_select() result when it could not set up waiting */
+#define IMPL_CHAN_ERROR (-2)
+
+struct impl_chan_waiter {
+    struct impl_chan_waiter *prev, *next;
+    struct impl_chan_ctx *ctx;
+    void *elem;
+    int index;
+    int queued;
+};
+
+struct impl_chan_waitq {
+    struct impl_chan_waiter *head, *tail;
+};
+
+typedef struct {
+    mtx_t mtx;
+    unsigned char *buf;
+    size_t elem_size;
+    size_t cap;
+    size_t head;
+    size_t count;
+    int closed;
+    struct impl_chan_waitq sendq;
+    struct impl_chan_waitq recvq;
+} chan_t;
+
+enum {
+    CHAN_SEND,
+    CHAN_RECV
+};
+
+struct chan_case {
+    chan_t *ch;
+    int op;      // CHAN_SEND or CHAN_RECV
+    void *elem;  // element to send, or buffer to receive into (may be NULL)
+    int rt;      // set for the completed case: thrd_success or thrd_error
+};
+
+static inline int
+chan_init(chan_t *ch, size_t elem_size, size_t capacity)
+{
+    assert(ch != NULL);
+    assert(elem_size > 0);
+    ch->buf = NULL;
+    if (capacity) {
+        ch->buf = (unsigned char *)malloc(elem_size * capacity);
+        if (!ch->buf)
+            return thrd_nomem;
+    }
+    if (mtx_init(&ch->mtx, mtx_plain) != thrd_success) {
+        free(ch->buf);
+        return thrd_error;
+    }
+    ch->elem_size = elem_size;
+    ch->cap = capacity;
+    ch->head = 0;
+    ch->count = 0;
+    ch->closed = 0;
+    ch->sendq.head = ch->sendq.tail = NULL;
+    ch->recvq.head = ch->recvq.tail = NULL;
+    return thrd_success;
+}
+
+static inline void
+chan_destroy(chan_t *ch)
+{
+    assert(ch != NULL);
+    assert(!ch->sendq.head && !ch->recvq.head);
+    mtx_destroy(&ch->mtx);
+    free(ch->buf);
+}
+
+static inline void
+impl_chan_waitq_push(struct impl_chan_waitq *q, struct impl_chan_waiter *w)
+{
+    w->next = NULL;
+    w->prev = q->tail;
+    if (q->tail)
+        q->tail->next = w;
+    else
+        q->head = w;
+    q->tail = w;
+    w->queued = 1;
+}
+
+static inline void
+impl_chan_waitq_remove(struct impl_chan_waitq *q, struct impl_chan_waiter *w)
+{
+    if (w->prev)
+        w->prev->next = w->next;
+    else
+        q->head = w->next;
+    if (w->next)
+        w->next->prev = w->prev;
+    else
+        q->tail = w->prev;
+    w->queued = 0;
+}
+
+static inline int
+impl_chan_claim(struct impl_chan_ctx *ctx, int index)
+{
+    int expected = -1;
+    return __atomic_compare_exchange_n(&ctx->fired, &expected, index, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Dequeue and claim the first waiter not belonging to self. Waiters of
+ * selects that already completed elsewhere are dropped on the way.
+ */
+static inline struct impl_chan_waiter *
+impl_chan_waitq_claim(struct impl_chan_waitq *q, struct impl_chan_ctx *self)
+{
+    struct impl_chan_waiter *w = q->head, *next;
+    for (; w; w = next) {
+        next = w->next;
+        if (w->ctx == self)
+            continue;
+        impl_chan_waitq_remove(q, w);
+        if (impl_chan_claim(w->ctx, w->index))
+            return w;
+    }
+    return NULL;
+}
+
+/* true if q holds a waiter that could still be claimed */
+static inline int
+impl_chan_waitq_ready(const struct impl_chan_waitq *q, const struct impl_chan_ctx *self)
+{
+    const struct impl_chan_waiter *w;
+    for (w = q->head; w; w = w->next) {
+        if (w->ctx != self && __atomic_load_n(&w->ctx->fired, __ATOMIC_ACQUIRE) == -1)
+            return 1;
+    }
+    return 0;
+}
+
+static inline void
+impl_chan_complete(struct impl_chan_waiter *w, int rt)
+{
+    struct impl_chan_ctx *ctx = w->ctx;
+    mtx_lock(&ctx->mtx);
+    ctx->rt = rt;
+    ctx->done = 1;
+    cnd_signal(&ctx->cnd);
+    mtx_unlock(&ctx->mtx);
+}
+
+static inline void *
+impl_chan_slot(chan_t *ch, size_t i)
+{
+    return ch->buf + ((ch->head + i) % ch->cap) * ch->elem_size;
+}
+
+/*
+ * With ch->mtx held: 1 when sent, possibly to *wake which the caller
+ * completes after unlocking, -1 when closed, 0 when the send would block.
+ */
+static inline int
+impl_chan_try_send_locked(chan_t *ch, const void *elem, struct impl_chan_ctx *self,
+                          struct impl_chan_waiter **wake)
+{
+    struct impl_chan_waiter *w;
+    *wake = NULL;
+    if (ch->closed)
+        return -1;
+    if ((w = impl_chan_waitq_claim(&ch->recvq, self)) != NULL) {
+        if (w->elem)
+            memcpy(w->elem, elem, ch->elem_size);
+        *wake = w;
+        return 1;
+    }
+    if (ch->count < ch->cap) {
+        memcpy(impl_chan_slot(ch, ch->count), elem, ch->elem_size);
+        ch->count++;
+        return 1;
+    }
+    return 0;
+}
+
+static inline int
+impl_chan_try_recv_locked(chan_t *ch, void *elem, struct impl_chan_ctx *self,
+                          struct impl_chan_waiter **wake)
+{
+    struct impl_chan_waiter *w;
+    *wake = NULL;
+    if (ch->count) {
+        if (elem)
+            memcpy(elem, impl_chan_slot(ch, 0), ch->elem_size);
+        ch->head = (ch->head + 1) % ch->cap;
+        ch->count--;
+        // refill from a blocked sender so the buffer keeps its order
+        if ((w = impl_chan_waitq_claim(&ch->sendq, self)) != NULL) {
+            memcpy(impl_chan_slot(ch, ch->count), w->elem, ch->elem_size);
+            ch->count++;
+            *wake = w;
+        }
+        return 1;
+    }
+    if ((w = impl_chan_waitq_claim(&ch->sendq, self)) != NULL) {
+        if (elem)
+            memcpy(elem, w->elem, ch->elem_size);
+        *wake = w;
+        return 1;
+    }
+    if (ch->closed) {
+        if (elem)
+            memset(elem, 0, ch->elem_size);
+        return -1;
+    }
+    return 0;
+}
+
+static inline int
+impl_chan_ready_locked(chan_t *ch, int op, struct impl_chan_ctx *self)
+{
+    if (ch->closed)
+        return 1;
+    if (op == CHAN_SEND)
+        return ch->count < ch->cap || impl_chan_waitq_ready(&ch->recvq, self);
+    return ch->count || impl_chan_waitq_ready(&ch->sendq, self);
+}
+
+static inline int
+impl_chan_try_locked(struct chan_case *c, struct impl_chan_ctx *self,
+                     struct impl_chan_waiter **wake)
+{
+    if (c->op == CHAN_SEND)
+        return impl_chan_try_send_locked(c->ch, c->elem, self, wake);
+    return impl_chan_try_recv_locked(c->ch, c->elem, self, wake);
+}
+
+static inline unsigned
+impl_chan_random(void)
+{
+    static __thread unsigned seed;
+    if (!seed)
+        seed = (unsigned)(uintptr_t)&seed | 1;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+/*
+ * Remove the wait records w[0..n) still queued on their channel. The
+ * record of case fired was already removed by the peer that claimed it.
+ */
+static inline void
+impl_chan_dequeue(struct chan_case *cases, struct impl_chan_waiter *w, int n, int fired)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+        chan_t *ch = cases[w[i].index].ch;
+        if (w[i].index == fired)
+            continue;
+        mtx_lock(&ch->mtx);
+        if (w[i].queued)
+            impl_chan_waitq_remove(cases[w[i].index].op == CHAN_SEND ? &ch->sendq : &ch->recvq, &w[i]);
+        mtx_unlock(&ch->mtx);
+    }
+}
+
+/*
+ * Returns the index of the completed case, -1 if none was ready
+ * (block == 0) or abs_time passed, or IMPL_CHAN_ERROR.
+ */
+static inline int
+impl_chan_select(struct chan_case *cases, int n, const struct timespec *abs_time, int block)
+{
+    struct impl_chan_waiter w[CHAN_SELECT_MAX], *wake;
+    struct impl_chan_ctx ctx;
+    int start, k, r, queued, self;
+
+    assert(n > 0 && n <= CHAN_SELECT_MAX);
+    start = n > 1 ? (int)(impl_chan_random() % (unsigned)n) : 0;
+
+    for (;;) {
+        // poll every case in random order
+        for (k = 0; k < n; k++) {
+            struct chan_case *c = &cases[(start + k) % n];
+            mtx_lock(&c->ch->mtx);
+            r = impl_chan_try_locked(c, NULL, &wake);
+            mtx_unlock(&c->ch->mtx);
+            if (r) {
+                c->rt = r > 0 ? thrd_success : thrd_error;
+                if (wake)
+                    impl_chan_complete(wake, thrd_success);
+                return (start + k) % n;
+            }
+        }
+        if (!block)
+            return -1;
+
+        if (mtx_init(&ctx.mtx, mtx_plain) != thrd_success)
+            return IMPL_CHAN_ERROR;
+        if (cnd_init(&ctx.cnd) != thrd_success) {
+            mtx_destroy(&ctx.mtx);
+            return IMPL_CHAN_ERROR;
+        }
+        ctx.fired = -1;
+        ctx.done = 0;
+        ctx.rt = thrd_success;
+
+        /*
+         * Queue on every channel, re-checking each under its lock. A case
+         * that became ready meanwhile is completed here if the select can
+         * still be claimed; otherwise a peer already claimed it.
+         */
+        wake = NULL;
+        self = -1;
+        r = 0;
+        for (queued = 0; queued < n; queued++) {
+            int i = (start + queued) % n;
+            struct chan_case *c = &cases[i];
+            mtx_lock(&c->ch->mtx);
+            if (impl_chan_ready_locked(c->ch, c->op, &ctx)) {
+                if (impl_chan_claim(&ctx, i)) {
+                    self = i;
+                    r = impl_chan_try_locked(c, &ctx, &wake);
+                }
+                mtx_unlock(&c->ch->mtx);
+                break;
+            }
+            w[queued].ctx = &ctx;
+            w[queued].elem = c->elem;
+            w[queued].index = i;
+            impl_chan_waitq_push(c->op == CHAN_SEND ? &c->ch->sendq : &c->ch->recvq, &w[queued]);
+            mtx_unlock(&c->ch->mtx);
+        }
+        if (wake)
+            impl_chan_complete(wake, thrd_success);
+
+        if (self < 0) {
+            mtx_lock(&ctx.mtx);
+            while (!ctx.done) {
+                if (!abs_time || queued < n) {
+                    cnd_wait(&ctx.cnd, &ctx.mtx);
+                } else if (cnd_timedwait(&ctx.cnd, &ctx.mtx, abs_time) != thrd_success) {
+                    if (impl_chan_claim(&ctx, IMPL_CHAN_TIMEDOUT))
+                        break;
+                    abs_time = NULL;  // claimed meanwhile, completion is imminent
+                }
+            }
+            mtx_unlock(&ctx.mtx);
+        }
+        // a single-case wait completed by its peer is no longer queued anywhere
+        if (!(ctx.done && queued == 1))
+            impl_chan_dequeue(cases, w, queued,
+                              ctx.done ? __atomic_load_n(&ctx.fired, __ATOMIC_RELAXED) : -1);
+        cnd_destroy(&ctx.cnd);
+        mtx_destroy(&ctx.mtx);
+
+        if (self >= 0 && r) {
+            cases[self].rt = r > 0 ? thrd_success : thrd_error;
+            return self;
+        }
+        if (ctx.done) {
+            cases[ctx.fired].rt = ctx.rt;
+            return ctx.fired;
+        }
+        if (self < 0)
+            return -1;  // timed out
+        // the peer seen ready went away before we got to it; start over
+    }
+}
+
+static inline int
+impl_chan_op(chan_t *ch, int op, void *elem, const struct timespec *abs_time, int block)
+{
+    struct chan_case c;
+    assert(ch != NULL);
+    c.ch = ch;
+    c.op = op;
+    c.elem = elem;
+    c.rt = thrd_error;
+    switch (impl_chan_select(&c, 1, abs_time, block)) {
+    case -1:
+        return block ? thrd_timeout : thrd_busy;
+    case IMPL_CHAN_ERROR:
+        return thrd_error;
+    }
+    return c.rt;
+}
+
+static inline int
+chan_send(chan_t *ch, const void *elem)
+{
+    return impl_chan_op(ch, CHAN_SEND, (void *)elem, NULL, 1);
+}
+
+static inline int
+chan_timedsend(chan_t *ch, const void *elem, const struct timespec *abs_time)
+{
+    return impl_chan_op(ch, CHAN_SEND, (void *)elem, abs_time, 1);
+}
+
+static inline int
+chan_trysend(chan_t *ch, const void *elem)
+{
+    return impl_chan_op(ch, CHAN_SEND, (void *)elem, NULL, 0);
+}
+
+static inline int
+chan_recv(chan_t *ch, void *elem)
+{
+    return impl_chan_op(ch, CHAN_RECV, elem, NULL, 1);
+}
+
+static inline int
+chan_timedrecv(chan_t *ch, void *elem, const struct timespec *abs_time)
+{
+    return impl_chan_op(ch, CHAN_RECV, elem, abs_time, 1);
+}
+
+static inline int
+chan_tryrecv(chan_t *ch, void *elem)
+{
+    return impl_chan_op(ch, CHAN_RECV, elem, NULL, 0);
+}
+
+/*
+ * Returns the index of the completed case, or -2 if waiting could not
+ * be set up.
+ */
+static inline int
+chan_select(struct chan_case *cases, int n)
+{
+    return impl_chan_select(cases, n, NULL, 1);
+}
+
+/* returns the index of the completed case, -1 on timeout, or -2 as chan_select() */
+static inline int
+chan_timedselect(struct chan_case *cases, int n, const struct timespec *abs_time)
+{
+    return impl_chan_select(cases, n, abs_time, 1);
+}
+
+/* returns the index of the completed case, or -1 if none was ready */
+static inline int
+chan_tryselect(struct chan_case *cases, int n)
+{
+    return impl_chan_select(cases, n, NULL, 0);
+}
+
+/*
+ * Wakes every blocked sender and receiver with thrd_error. Buffered
+ * elements can still be received. Returns thrd_error if already closed.
+ */
+static inline int
+chan_close(chan_t *ch)
+{
+    struct impl_chan_waiter *woken = NULL, *w;
+    assert(ch != NULL);
+    mtx_lock(&ch->mtx);
+    if (ch->closed) {
+        mtx_unlock(&ch->mtx);
+        return thrd_error;
+    }
+    ch->closed = 1;
+    while ((w = impl_chan_waitq_claim(&ch->recvq, NULL)) != NULL) {
+        if (w->elem)
+            memset(w->elem, 0, ch->elem_size);
+        w->next = woken;
+        woken = w;
+    }
+    while ((w = impl_chan_waitq_claim(&ch->sendq, NULL)) != NULL) {
+        w->next = woken;
+        woken = w;
+    }
+    mtx_unlock(&ch->mtx);
+    while (woken) {
+        w = woken;
+        woken = w->next;  // w may be gone once completed
+        impl_chan_complete(w, thrd_error);
+    }
+    return thrd_success;
+}
+
+#endif /* CHAN_H_INCLUDED_ */
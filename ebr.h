@@ -0,0 +1,261 @@
+/*
+ * Epoch-based memory reclamation.
+ *
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file COPYING)
+ *
+ * Operations on a shared structure are bracketed with ebr_enter() and
+ * ebr_exit(); in between, any object reachable from the structure may
+ * be dereferenced without further protection:
+ *
+ *     ebr_enter(&dom);
+ *     for (n = list->head; n; n = n->next)
+ *         ...
+ *     ebr_exit(&dom);
+ *
+ *     // after unlinking node
+ *     ebr_retire(&dom, &node->ebr, free_node);
+ *
+ * A retired object is tagged with the global epoch. The epoch advances
+ * once every thread inside an operation has observed its current value,
+ * so an object tagged e cannot be reached by anybody after the epoch
+ * has reached e + 2 and is freed then, from its retiring thread's limbo
+ * list. Entering costs one fence per operation rather than one per
+ * protected load as with hazard pointers, but a thread stalled inside
+ * an operation holds back all reclamation.
+ *
+ * Per-thread state is found through a tss_t of the domain, and limbo
+ * objects left at thread exit are reclaimed by the other threads.
+ *
+ * Requires the GCC __atomic builtins.
+ */
+#ifndef EBR_H_INCLUDED_
+#define EBR_H_INCLUDED_
+
+#include <stdlib.h>
+#include "threads.h"
+
+#ifndef IMPL_CACHE_LINE
+#define IMPL_CACHE_LINE 64
+#endif
+
+/* retires between attempts to advance the epoch */
+#ifndef EBR_ADVANCE_EVERY
+#define EBR_ADVANCE_EVERY 64
+#endif
+
+struct ebr_obj {
+    struct ebr_obj *next;
+    unsigned long epoch;
+    void (*reclaim)(struct ebr_obj *obj);
+};
+
+struct impl_ebr_rec {
+    unsigned long state;  // observed epoch << 1 | 1 inside an operation, else 0
+    unsigned nest;
+    unsigned since_advance;
+    struct ebr_obj *limbo;  // newest first
+    struct impl_ebr_rec *next;
+    struct ebr_domain *domain;
+    int in_use;
+} __attribute__((aligned(IMPL_CACHE_LINE)));
+
+typedef struct ebr_domain {
+    unsigned long epoch __attribute__((aligned(IMPL_CACHE_LINE)));
+    struct impl_ebr_rec *recs __attribute__((aligned(IMPL_CACHE_LINE)));
+    struct ebr_obj *orphans;
+    tss_t key;
+} ebr_domain_t;
+
+static inline void
+impl_ebr_push_orphans(ebr_domain_t *d, struct ebr_obj *first)
+{
+    struct ebr_obj *last = first;
+    while (last->next)
+        last = last->next;
+    last->next = __atomic_load_n(&d->orphans, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&d->orphans, &last->next, first, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+}
+
+static inline void
+impl_ebr_thread_exit(void *p)
+{
+    struct impl_ebr_rec *rec = (struct impl_ebr_rec *)p;
+    __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+    rec->nest = 0;
+    if (rec->limbo) {
+        impl_ebr_push_orphans(rec->domain, rec->limbo);
+        rec->limbo = NULL;
+    }
+    __atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static inline int
+ebr_domain_init(ebr_domain_t *d)
+{
+    assert(d != NULL);
+    d->epoch = 2;  // so that epoch - 2 never wraps
+    d->recs = NULL;
+    d->orphans = NULL;
+    return tss_create(&d->key, impl_ebr_thread_exit);
+}
+
+static inline void
+impl_ebr_reclaim_list(struct ebr_obj *obj)
+{
+    struct ebr_obj *next;
+    for (; obj; obj = next) {
+        next = obj->next;
+        obj->reclaim(obj);
+    }
+}
+
+/* reclaims everything still retired; no thread may use d any more */
+static inline void
+ebr_domain_destroy(ebr_domain_t *d)
+{
+    struct impl_ebr_rec *rec, *next;
+    struct ebr_obj *list;
+    assert(d != NULL);
+    // reclaim callbacks may retire further objects, so repeat until none are left
+    for (;;) {
+        list = d->orphans;
+        d->orphans = NULL;
+        for (rec = d->recs; rec && !list; rec = rec->next) {
+            list = rec->limbo;
+            rec->limbo = NULL;
+        }
+        if (!list)
+            break;
+        impl_ebr_reclaim_list(list);
+    }
+    tss_delete(d->key);
+    for (rec = d->recs; rec; rec = next) {
+        next = rec->next;
+        free(rec);
+    }
+}
+
+static inline struct impl_ebr_rec *
+impl_ebr_rec_get(ebr_domain_t *d)
+{
+    struct impl_ebr_rec *rec = (struct impl_ebr_rec *)tss_get(d->key);
+    if (__builtin_expect(rec != NULL, 1))
+        return rec;
+
+    for (rec = __atomic_load_n(&d->recs, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&rec->in_use, &expected, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (!rec) {
+        rec = (struct impl_ebr_rec *)calloc(1, sizeof(*rec));
+        if (!rec)
+            abort();
+        rec->domain = d;
+        rec->in_use = 1;
+        rec->next = __atomic_load_n(&d->recs, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&d->recs, &rec->next, rec, 1,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            ;
+    }
+    tss_set(d->key, rec);
+    return rec;
+}
+
+/* may nest; only the outermost pair has an effect */
+static inline void
+ebr_enter(ebr_domain_t *d)
+{
+    struct impl_ebr_rec *rec = impl_ebr_rec_get(d);
+    if (rec->nest++ == 0) {
+        unsigned long e = __atomic_load_n(&d->epoch, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&rec->state, e << 1 | 1, __ATOMIC_RELAXED);
+        // announce before reading the structure
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+}
+
+static inline void
+ebr_exit(ebr_domain_t *d)
+{
+    struct impl_ebr_rec *rec = impl_ebr_rec_get(d);
+    assert(rec->nest > 0);
+    if (--rec->nest == 0)
+        __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Unlinks and returns the objects of *list (newest first) retired
+ * before epoch - 1, so that reclaim callbacks can retire onto *list.
+ */
+static inline struct ebr_obj *
+impl_ebr_detach_older(struct ebr_obj **list, unsigned long epoch)
+{
+    struct ebr_obj **link = list, *old;
+    while (*link && (*link)->epoch + 2 > epoch)
+        link = &(*link)->next;
+    old = *link;
+    *link = NULL;
+    return old;
+}
+
+/*
+ * Advances the global epoch if every thread inside an operation has
+ * seen it, then reclaims what the calling thread can. Returns the
+ * global epoch.
+ */
+static inline unsigned long
+ebr_advance(ebr_domain_t *d)
+{
+    struct impl_ebr_rec *self = impl_ebr_rec_get(d), *rec;
+    struct ebr_obj *orphans, *obj, *next, *keep = NULL;
+    unsigned long e = __atomic_load_n(&d->epoch, __ATOMIC_SEQ_CST);
+
+    for (rec = __atomic_load_n(&d->recs, __ATOMIC_SEQ_CST); rec; rec = rec->next) {
+        unsigned long s = __atomic_load_n(&rec->state, __ATOMIC_SEQ_CST);
+        if ((s & 1) && (s >> 1) != e)
+            break;
+    }
+    if (!rec && __atomic_compare_exchange_n(&d->epoch, &e, e + 1, 0,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        e++;
+
+    impl_ebr_reclaim_list(impl_ebr_detach_older(&self->limbo, e));
+    if (__atomic_load_n(&d->orphans, __ATOMIC_RELAXED)) {
+        orphans = __atomic_exchange_n(&d->orphans, NULL, __ATOMIC_ACQUIRE);
+        for (obj = orphans; obj; obj = next) {
+            next = obj->next;
+            if (obj->epoch + 2 <= e) {
+                obj->reclaim(obj);
+            } else {
+                obj->next = keep;
+                keep = obj;
+            }
+        }
+        if (keep)
+            impl_ebr_push_orphans(d, keep);
+    }
+    return e;
+}
+
+/* obj must already be unreachable for new operations */
+static inline void
+ebr_retire(ebr_domain_t *d, struct ebr_obj *obj, void (*reclaim)(struct ebr_obj *obj))
+{
+    struct impl_ebr_rec *rec = impl_ebr_rec_get(d);
+    assert(obj != NULL && reclaim != NULL);
+    obj->reclaim = reclaim;
+    obj->epoch = __atomic_load_n(&d->epoch, __ATOMIC_SEQ_CST);
+    obj->next = rec->limbo;
+    rec->limbo = obj;
+    if (++rec->since_advance >= EBR_ADVANCE_EVERY) {
+        rec->since_advance = 0;
+        ebr_advance(d);
+    }
+}
+
+#endif /* EBR_H_INCLUDED_ */
@@ -0,0 +1,138 @@
+/*
+ * Event count: lets a thread sleep until some lock-free condition may
+ * have changed, without taking a lock on the fast path of the notifier.
+ *
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file COPYING)
+ *
+ * A waiter announces itself, re-checks its condition and only then
+ * blocks:
+ *
+ *     while (!try_pop(q, &item)) {
+ *         unsigned key = eventcount_prepare(&ec);
+ *         if (try_pop(q, &item)) {
+ *             eventcount_cancel(&ec);
+ *             break;
+ *         }
+ *         eventcount_wait(&ec, key);
+ *     }
+ *
+ * and the other side calls eventcount_notify() after making the change
+ * visible. notify is a fence and a load unless somebody is waiting.
+ * Callers usually retry for EVENTCOUNT_SPIN rounds before preparing.
+ *
+ * Requires the GCC __atomic builtins.
+ */
+#ifndef EVENTCOUNT_H_INCLUDED_
+#define EVENTCOUNT_H_INCLUDED_
+
+#include "threads.h"
+
+/* failed attempts a blocking operation spins for before it parks */
+#ifndef EVENTCOUNT_SPIN
+#define EVENTCOUNT_SPIN 100
+#endif
+
+static inline void
+impl_eventcount_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+typedef struct {
+    unsigned seq;      // bumped under mtx by every notify that saw waiters
+    unsigned waiters;  // threads between prepare and wait/cancel
+    mtx_t mtx;
+    cnd_t cnd;
+} eventcount_t;
+
+static inline int
+eventcount_init(eventcount_t *ec)
+{
+    ec->seq = 0;
+    ec->waiters = 0;
+    if (mtx_init(&ec->mtx, mtx_plain) != thrd_success)
+        return thrd_error;
+    if (cnd_init(&ec->cnd) != thrd_success) {
+        mtx_destroy(&ec->mtx);
+        return thrd_error;
+    }
+    return thrd_success;
+}
+
+static inline void
+eventcount_destroy(eventcount_t *ec)
+{
+    assert(ec->waiters == 0);
+    cnd_destroy(&ec->cnd);
+    mtx_destroy(&ec->mtx);
+}
+
+static inline unsigned
+eventcount_prepare(eventcount_t *ec)
+{
+    unsigned key = __atomic_load_n(&ec->seq, __ATOMIC_ACQUIRE);
+    __atomic_fetch_add(&ec->waiters, 1, __ATOMIC_SEQ_CST);
+    // order the announcement before the caller re-checks its condition
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return key;
+}
+
+static inline void
+eventcount_cancel(eventcount_t *ec)
+{
+    __atomic_fetch_sub(&ec->waiters, 1, __ATOMIC_RELAXED);
+}
+
+static inline void
+eventcount_wait(eventcount_t *ec, unsigned key)
+{
+    mtx_lock(&ec->mtx);
+    while (__atomic_load_n(&ec->seq, __ATOMIC_RELAXED) == key)
+        cnd_wait(&ec->cnd, &ec->mtx);
+    mtx_unlock(&ec->mtx);
+    __atomic_fetch_sub(&ec->waiters, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * abs_time is based on TIME_UTC, as for cnd_timedwait(). Returns
+ * thrd_timeout if it passed before a notification, whichever code
+ * cnd_timedwait() uses for that.
+ */
+static inline int
+eventcount_timedwait(eventcount_t *ec, unsigned key, const struct timespec *abs_time)
+{
+    int rt = thrd_success;
+    mtx_lock(&ec->mtx);
+    while (__atomic_load_n(&ec->seq, __ATOMIC_RELAXED) == key) {
+        rt = cnd_timedwait(&ec->cnd, &ec->mtx, abs_time);
+        if (rt != thrd_success)
+            break;
+    }
+    if (__atomic_load_n(&ec->seq, __ATOMIC_RELAXED) != key)
+        rt = thrd_success;
+    else if (rt != thrd_error)
+        rt = thrd_timeout;
+    mtx_unlock(&ec->mtx);
+    __atomic_fetch_sub(&ec->waiters, 1, __ATOMIC_RELAXED);
+    return rt;
+}
+
+static inline void
+eventcount_notify(eventcount_t *ec)
+{
+    // pairs with the fence in eventcount_prepare()
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__builtin_expect(__atomic_load_n(&ec->waiters, __ATOMIC_RELAXED) == 0, 1))
+        return;
+    mtx_lock(&ec->mtx);
+    __atomic_store_n(&ec->seq, ec->seq + 1, __ATOMIC_RELAXED);
+    cnd_broadcast(&ec->cnd);
+    mtx_unlock(&ec->mtx);
+}
+
+#endif /* EVENTCOUNT_H_INCLUDED_ */
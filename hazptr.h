@@ -0,0 +1,305 @@
+/*
+ * Hazard pointers for safe memory reclamation in lock-free structures.
+ *
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file COPYING)
+ *
+ * A reader publishes the pointer it is about to dereference in one of
+ * its hazard slots; a retired object is only reclaimed once no slot in
+ * the domain holds it:
+ *
+ *     node = hazptr_protect(&dom, 0, (void *const *)&list->head);
+ *     ... use node ...
+ *     hazptr_clear(&dom, 0);
+ *
+ *     // after unlinking node
+ *     hazptr_retire(&dom, node, &node->hazptr, free_node);
+ *
+ * The object is retired under the address readers protect, so the
+ * struct hazptr_obj member may be anywhere in it.
+ * Each thread finds its slots and retire list through a tss_t of the
+ * domain and gets them on first use. Retired objects collect per thread
+ * until there are more than HAZPTR_SCAN_FACTOR times as many as there
+ * are slots of live threads in the domain, so a scan frees at least half of them and
+ * the reclamation cost per object stays constant. Objects still retired
+ * when a thread exits are handed to the next scan of another thread.
+ *
+ * Requires the GCC __atomic builtins.
+ */
+#ifndef HAZPTR_H_INCLUDED_
+#define HAZPTR_H_INCLUDED_
+
+#include <stdlib.h>
+#include "threads.h"
+
+#ifndef IMPL_CACHE_LINE
+#define IMPL_CACHE_LINE 64
+#endif
+
+/*
+Implementation limits:
+  - HAZPTR_SLOTS hazard pointers per thread and domain
+*/
+#ifndef HAZPTR_SLOTS
+#define HAZPTR_SLOTS 4
+#endif
+#ifndef HAZPTR_SCAN_FACTOR
+#define HAZPTR_SCAN_FACTOR 2
+#endif
+#define IMPL_HAZPTR_SCAN_MIN 64
+
+struct hazptr_obj {
+    struct hazptr_obj *next;
+    void *ptr;  // the address readers protect
+    void (*reclaim)(struct hazptr_obj *obj);
+};
+
+struct impl_hazptr_rec {
+    void *hp[HAZPTR_SLOTS];
+    struct impl_hazptr_rec *next;
+    struct hazptr_domain *domain;
+    struct hazptr_obj *retired;
+    size_t nretired;
+    int scanning;  // reclaim callbacks may retire, but not scan again
+    int in_use;
+} __attribute__((aligned(IMPL_CACHE_LINE)));
+
+typedef struct hazptr_domain {
+    struct impl_hazptr_rec *recs;
+    size_t nactive;  // records in use by a thread
+    struct hazptr_obj *orphans;  // retired by threads that exited
+    tss_t key;
+} hazptr_domain_t;
+
+static inline void
+impl_hazptr_thread_exit(void *p)
+{
+    struct impl_hazptr_rec *rec = (struct impl_hazptr_rec *)p;
+    struct hazptr_domain *d = rec->domain;
+    int i;
+    for (i = 0; i < HAZPTR_SLOTS; i++)
+        __atomic_store_n(&rec->hp[i], NULL, __ATOMIC_RELEASE);
+    if (rec->retired) {
+        struct hazptr_obj *last = rec->retired;
+        while (last->next)
+            last = last->next;
+        last->next = __atomic_load_n(&d->orphans, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&d->orphans, &last->next, rec->retired, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+        rec->retired = NULL;
+        rec->nretired = 0;
+    }
+    __atomic_fetch_sub(&d->nactive, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static inline int
+hazptr_domain_init(hazptr_domain_t *d)
+{
+    assert(d != NULL);
+    d->recs = NULL;
+    d->nactive = 0;
+    d->orphans = NULL;
+    return tss_create(&d->key, impl_hazptr_thread_exit);
+}
+
+/* reclaims everything still retired; no thread may use d any more */
+static inline void
+hazptr_domain_destroy(hazptr_domain_t *d)
+{
+    struct impl_hazptr_rec *rec, *next_rec;
+    struct hazptr_obj *obj, *next;
+    assert(d != NULL);
+    // reclaim callbacks may retire further objects, so repeat until none are left
+    for (;;) {
+        obj = d->orphans;
+        d->orphans = NULL;
+        for (rec = d->recs; rec && !obj; rec = rec->next) {
+            obj = rec->retired;
+            rec->retired = NULL;
+            rec->nretired = 0;
+        }
+        if (!obj)
+            break;
+        for (; obj; obj = next) {
+            next = obj->next;
+            obj->reclaim(obj);
+        }
+    }
+    tss_delete(d->key);
+    for (rec = d->recs; rec; rec = next_rec) {
+        next_rec = rec->next;
+        free(rec);
+    }
+}
+
+static inline struct impl_hazptr_rec *
+impl_hazptr_rec_get(hazptr_domain_t *d)
+{
+    struct impl_hazptr_rec *rec = (struct impl_hazptr_rec *)tss_get(d->key);
+    if (__builtin_expect(rec != NULL, 1))
+        return rec;
+
+    for (rec = __atomic_load_n(&d->recs, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&rec->in_use, &expected, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (!rec) {
+        rec = (struct impl_hazptr_rec *)calloc(1, sizeof(*rec));
+        if (!rec)
+            abort();
+        rec->domain = d;
+        rec->in_use = 1;
+        rec->next = __atomic_load_n(&d->recs, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&d->recs, &rec->next, rec, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    __atomic_fetch_add(&d->nactive, 1, __ATOMIC_RELAXED);
+    tss_set(d->key, rec);
+    return rec;
+}
+
+/*
+ * Loads *src into hazard slot `slot' of the calling thread and returns
+ * it once the slot is known to have been published while *src still
+ * held it. The object stays valid until the slot is cleared or reused.
+ */
+static inline void *
+hazptr_protect(hazptr_domain_t *d, int slot, void *const *src)
+{
+    struct impl_hazptr_rec *rec = impl_hazptr_rec_get(d);
+    void *p = __atomic_load_n(src, __ATOMIC_RELAXED);
+    assert(slot >= 0 && slot < HAZPTR_SLOTS);
+    for (;;) {
+        void *q;
+        __atomic_store_n(&rec->hp[slot], p, __ATOMIC_RELAXED);
+        // publish the slot before re-checking the source
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        q = __atomic_load_n(src, __ATOMIC_ACQUIRE);
+        if (q == p)
+            return p;
+        p = q;
+    }
+}
+
+/* protects p, which the caller knows to be safe, e.g. already protected */
+static inline void
+hazptr_set(hazptr_domain_t *d, int slot, void *p)
+{
+    struct impl_hazptr_rec *rec = impl_hazptr_rec_get(d);
+    assert(slot >= 0 && slot < HAZPTR_SLOTS);
+    __atomic_store_n(&rec->hp[slot], p, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void
+hazptr_clear(hazptr_domain_t *d, int slot)
+{
+    struct impl_hazptr_rec *rec = impl_hazptr_rec_get(d);
+    assert(slot >= 0 && slot < HAZPTR_SLOTS);
+    __atomic_store_n(&rec->hp[slot], NULL, __ATOMIC_RELEASE);
+}
+
+static inline int
+impl_hazptr_cmp(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)*(void *const *)a, y = (uintptr_t)*(void *const *)b;
+    return (x > y) - (x < y);
+}
+
+/* reclaims the calling thread's retired objects no slot protects */
+static inline void
+hazptr_scan(hazptr_domain_t *d)
+{
+    struct impl_hazptr_rec *self = impl_hazptr_rec_get(d), *head, *rec;
+    struct hazptr_obj *obj, *next, *list, *keep = NULL, *last = NULL;
+    size_t nhp = 0, cap = 0, nkeep = 0;
+    void **hps;
+
+    if (self->scanning)
+        return;
+
+    // adopt what exited threads left behind
+    obj = __atomic_exchange_n(&d->orphans, NULL, __ATOMIC_ACQUIRE);
+    for (; obj; obj = next) {
+        next = obj->next;
+        obj->next = self->retired;
+        self->retired = obj;
+        self->nretired++;
+    }
+
+    // order the unlinking of retired objects before reading the slots
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    head = __atomic_load_n(&d->recs, __ATOMIC_SEQ_CST);
+    for (rec = head; rec; rec = rec->next)
+        cap += HAZPTR_SLOTS;
+    hps = (void **)malloc(cap * sizeof(*hps));
+    if (!hps)
+        return;
+    // threads registered after head was read cannot see a retired object
+    for (rec = head; rec; rec = rec->next) {
+        int i;
+        for (i = 0; i < HAZPTR_SLOTS; i++) {
+            void *p = __atomic_load_n(&rec->hp[i], __ATOMIC_ACQUIRE);
+            if (p)
+                hps[nhp++] = p;
+        }
+    }
+    qsort(hps, nhp, sizeof(*hps), impl_hazptr_cmp);
+
+    // callbacks may retire more objects onto self->retired
+    list = self->retired;
+    self->retired = NULL;
+    self->nretired = 0;
+    self->scanning = 1;
+    for (obj = list; obj; obj = next) {
+        void *key = obj->ptr;
+        next = obj->next;
+        if (bsearch(&key, hps, nhp, sizeof(*hps), impl_hazptr_cmp)) {
+            obj->next = keep;
+            if (!keep)
+                last = obj;
+            keep = obj;
+            nkeep++;
+        } else {
+            obj->reclaim(obj);
+        }
+    }
+    self->scanning = 0;
+    if (keep) {
+        last->next = self->retired;
+        self->retired = keep;
+        self->nretired += nkeep;
+    }
+    free(hps);
+}
+
+/*
+ * Retires the object readers know as ptr, whose struct hazptr_obj is
+ * obj; reclaim(obj) runs once no slot holds ptr. ptr must already be
+ * unreachable for new readers.
+ */
+static inline void
+hazptr_retire(hazptr_domain_t *d, void *ptr, struct hazptr_obj *obj,
+              void (*reclaim)(struct hazptr_obj *obj))
+{
+    struct impl_hazptr_rec *rec = impl_hazptr_rec_get(d);
+    size_t threshold;
+    assert(ptr != NULL && obj != NULL && reclaim != NULL);
+    obj->ptr = ptr;
+    obj->reclaim = reclaim;
+    obj->next = rec->retired;
+    rec->retired = obj;
+    rec->nretired++;
+    threshold = HAZPTR_SCAN_FACTOR * HAZPTR_SLOTS * __atomic_load_n(&d->nactive, __ATOMIC_RELAXED);
+    if (threshold < IMPL_HAZPTR_SCAN_MIN)
+        threshold = IMPL_HAZPTR_SCAN_MIN;
+    if (rec->nretired >= threshold)
+        hazptr_scan(d);
+}
+
+#endif /* HAZPTR_H_INCLUDED_ */
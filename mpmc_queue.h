@@ -0,0 +1,180 @@
+/*
+ * Bounded lock-free multi-producer/multi-consumer queue of pointers.
+ *
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file COPYING)
+ *
+ * Dmitry Vyukov's array queue: every cell carries a sequence number
+ * telling producers and consumers whose turn it is, so try_push and
+ * try_pop are a CAS on the shared position plus a release store on the
+ * cell, and never take a lock. The blocking variants park on an event
+ * count only when the queue is full or empty.
+ *
+ * Requires the GCC __atomic builtins.
+ */
+#ifndef MPMC_QUEUE_H_INCLUDED_
+#define MPMC_QUEUE_H_INCLUDED_
+
+#include <stddef.h>
+#include "threads.h"
+#include "eventcount.h"
+
+#ifndef IMPL_CACHE_LINE
+#define IMPL_CACHE_LINE 64
+#endif
+
+struct impl_mpmc_cell {
+    size_t seq;
+    void *data;
+};
+
+typedef struct {
+    struct impl_mpmc_cell *cells;
+    size_t mask;
+    size_t enqueue_pos __attribute__((aligned(IMPL_CACHE_LINE)));
+    size_t dequeue_pos __attribute__((aligned(IMPL_CACHE_LINE)));
+    eventcount_t not_empty __attribute__((aligned(IMPL_CACHE_LINE)));
+    eventcount_t not_full;
+} mpmc_queue_t;
+
+/* capacity is rounded up to a power of two, at least 2 */
+static inline int
+mpmc_queue_init(mpmc_queue_t *q, size_t capacity)
+{
+    size_t size = 2, i;
+    assert(q != NULL);
+    while (size < capacity)
+        size <<= 1;
+    q->cells = (struct impl_mpmc_cell *)malloc(size * sizeof(q->cells[0]));
+    if (!q->cells)
+        return thrd_nomem;
+    for (i = 0; i < size; i++)
+        q->cells[i].seq = i;
+    q->mask = size - 1;
+    q->enqueue_pos = 0;
+    q->dequeue_pos = 0;
+    if (eventcount_init(&q->not_empty) != thrd_success) {
+        free(q->cells);
+        return thrd_error;
+    }
+    if (eventcount_init(&q->not_full) != thrd_success) {
+        eventcount_destroy(&q->not_empty);
+        free(q->cells);
+        return thrd_error;
+    }
+    return thrd_success;
+}
+
+static inline void
+mpmc_queue_destroy(mpmc_queue_t *q)
+{
+    assert(q != NULL);
+    eventcount_destroy(&q->not_full);
+    eventcount_destroy(&q->not_empty);
+    free(q->cells);
+}
+
+static inline size_t
+mpmc_queue_capacity(const mpmc_queue_t *q)
+{
+    return q->mask + 1;
+}
+
+/* returns thrd_busy when the queue is full */
+static inline int
+mpmc_queue_try_push(mpmc_queue_t *q, void *item)
+{
+    struct impl_mpmc_cell *cell;
+    size_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        intptr_t dif;
+        size_t seq;
+        cell = &q->cells[pos & q->mask];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return thrd_busy;
+        } else {
+            pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    cell->data = item;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    eventcount_notify(&q->not_empty);
+    return thrd_success;
+}
+
+/* returns thrd_busy when the queue is empty */
+static inline int
+mpmc_queue_try_pop(mpmc_queue_t *q, void **item)
+{
+    struct impl_mpmc_cell *cell;
+    size_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+    assert(item != NULL);
+    for (;;) {
+        intptr_t dif;
+        size_t seq;
+        cell = &q->cells[pos & q->mask];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return thrd_busy;
+        } else {
+            pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    *item = cell->data;
+    __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+    eventcount_notify(&q->not_full);
+    return thrd_success;
+}
+
+static inline int
+mpmc_queue_push(mpmc_queue_t *q, void *item)
+{
+    int spin;
+    for (spin = 0; spin < EVENTCOUNT_SPIN; spin++) {
+        if (mpmc_queue_try_push(q, item) == thrd_success)
+            return thrd_success;
+        impl_eventcount_pause();
+    }
+    while (mpmc_queue_try_push(q, item) != thrd_success) {
+        unsigned key = eventcount_prepare(&q->not_full);
+        if (mpmc_queue_try_push(q, item) == thrd_success) {
+            eventcount_cancel(&q->not_full);
+            break;
+        }
+        eventcount_wait(&q->not_full, key);
+    }
+    return thrd_success;
+}
+
+static inline int
+mpmc_queue_pop(mpmc_queue_t *q, void **item)
+{
+    int spin;
+    for (spin = 0; spin < EVENTCOUNT_SPIN; spin++) {
+        if (mpmc_queue_try_pop(q, item) == thrd_success)
+            return thrd_success;
+        impl_eventcount_pause();
+    }
+    while (mpmc_queue_try_pop(q, item) != thrd_success) {
+        unsigned key = eventcount_prepare(&q->not_empty);
+        if (mpmc_queue_try_pop(q, item) == thrd_success) {
+            eventcount_cancel(&q->not_empty);
+            break;
+        }
+        eventcount_wait(&q->not_empty, key);
+    }
+    return thrd_success;
+}
+
+#endif /* MPMC_QUEUE_H_INCLUDED_ */
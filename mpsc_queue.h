@@ -0,0 +1,184 @@
+/*
+ * Unbounded intrusive multi-producer/single-consumer queue.
+ *
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file COPYING)
+ *
+ * Dmitry Vyukov's node-based queue. The link lives in the user's
+ * message, so pushing allocates nothing:
+ *
+ *     struct msg {
+ *         struct mpsc_node node;
+ *         int payload;
+ *     };
+ *
+ *     mpsc_queue_push(&q, &m->node);
+ *     ...
+ *     struct mpsc_node *n = mpsc_queue_try_pop(&q);
+ *     struct msg *m = mpsc_queue_entry(n, struct msg, node);
+ *
+ * A push is one atomic exchange plus a store. The consumer works on
+ * its own end of the list with plain loads and only touches the shared
+ * head when the queue runs dry. While a producer is between its
+ * exchange and its store the queue looks empty to the consumer even
+ * though it is not; try_pop returns NULL then and the blocking variants
+ * retry.
+ *
+ * With MPSC_QUEUE_BLOCKING the consumer may sleep in mpsc_queue_pop();
+ * producers then check an event count after each push and only wake
+ * the consumer through cnd_broadcast() when it is actually asleep.
+ *
+ * Requires the GCC __atomic builtins.
+ */
+#ifndef MPSC_QUEUE_H_INCLUDED_
+#define MPSC_QUEUE_H_INCLUDED_
+
+#include <stddef.h>
+#include "threads.h"
+#include "eventcount.h"
+
+#ifndef IMPL_CACHE_LINE
+#define IMPL_CACHE_LINE 64
+#endif
+
+enum {
+    MPSC_QUEUE_BLOCKING = 1
+};
+
+struct mpsc_node {
+    struct mpsc_node *next;
+};
+
+#define mpsc_queue_entry(node, type, member) \
+    ((type *)((char *)(node) - offsetof(type, member)))
+
+typedef struct {
+    struct mpsc_node *head __attribute__((aligned(IMPL_CACHE_LINE)));  // producers
+    struct mpsc_node *tail __attribute__((aligned(IMPL_CACHE_LINE)));  // consumer
+    struct mpsc_node stub;
+    int flags;
+    eventcount_t nonempty;
+} mpsc_queue_t;
+
+static inline int
+mpsc_queue_init(mpsc_queue_t *q, int flags)
+{
+    assert(q != NULL);
+    q->stub.next = NULL;
+    q->head = &q->stub;
+    q->tail = &q->stub;
+    q->flags = flags;
+    if (flags & MPSC_QUEUE_BLOCKING)
+        return eventcount_init(&q->nonempty);
+    return thrd_success;
+}
+
+/* nodes still queued are not touched */
+static inline void
+mpsc_queue_destroy(mpsc_queue_t *q)
+{
+    assert(q != NULL);
+    if (q->flags & MPSC_QUEUE_BLOCKING)
+        eventcount_destroy(&q->nonempty);
+}
+
+static inline void
+impl_mpsc_queue_link(mpsc_queue_t *q, struct mpsc_node *node)
+{
+    struct mpsc_node *prev;
+    node->next = NULL;
+    prev = __atomic_exchange_n(&q->head, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+static inline void
+mpsc_queue_push(mpsc_queue_t *q, struct mpsc_node *node)
+{
+    assert(node != NULL);
+    impl_mpsc_queue_link(q, node);
+    if (q->flags & MPSC_QUEUE_BLOCKING)
+        eventcount_notify(&q->nonempty);
+}
+
+/* consumer only: returns NULL when the queue is (or looks) empty */
+static inline struct mpsc_node *
+mpsc_queue_try_pop(mpsc_queue_t *q)
+{
+    struct mpsc_node *tail = q->tail;
+    struct mpsc_node *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &q->stub) {
+        if (!next)
+            return NULL;
+        q->tail = next;
+        tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    // tail is the last node; a push may be half done
+    if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+        return NULL;
+    impl_mpsc_queue_link(q, &q->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+/* consumer only: true if no push has completed or is in progress */
+static inline int
+mpsc_queue_empty(mpsc_queue_t *q)
+{
+    return q->tail == &q->stub
+        && __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == &q->stub;
+}
+
+/*
+ * Consumer only. abs_time is based on TIME_UTC; a NULL abs_time waits
+ * forever. Returns NULL on timeout.
+ */
+static inline struct mpsc_node *
+mpsc_queue_timedpop(mpsc_queue_t *q, const struct timespec *abs_time)
+{
+    struct mpsc_node *node;
+    int spin;
+    assert(q->flags & MPSC_QUEUE_BLOCKING);
+    for (spin = 0; spin < EVENTCOUNT_SPIN; spin++) {
+        if ((node = mpsc_queue_try_pop(q)) != NULL)
+            return node;
+        impl_eventcount_pause();
+    }
+    while ((node = mpsc_queue_try_pop(q)) == NULL) {
+        unsigned key;
+        if (!mpsc_queue_empty(q)) {
+            // a producer is between its exchange and its store
+            thrd_yield();
+            continue;
+        }
+        key = eventcount_prepare(&q->nonempty);
+        if (!mpsc_queue_empty(q)) {
+            eventcount_cancel(&q->nonempty);
+            continue;
+        }
+        if (!abs_time) {
+            eventcount_wait(&q->nonempty, key);
+        } else if (eventcount_timedwait(&q->nonempty, key, abs_time) != thrd_success) {
+            return mpsc_queue_try_pop(q);
+        }
+    }
+    return node;
+}
+
+/* consumer only */
+static inline struct mpsc_node *
+mpsc_queue_pop(mpsc_queue_t *q)
+{
+    return mpsc_queue_timedpop(q, NULL);
+}
+
+#endif /* MPSC_QUEUE_H_INCLUDED_ */
@@ -0,0 +1,118 @@
+/*
+ * Per-CPU sharded counters.
+ *
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file COPYING)
+ *
+ * A counter incremented from many threads bounces its cache line
+ * between CPUs on every update. pcpu_counter_t instead keeps one slot
+ * per CPU, each on its own cache line, and pcpu_counter_add() updates
+ * the slot of the CPU it runs on inside a restartable sequence (see
+ * rseq.h): no atomic instruction and no shared cache line.
+ * pcpu_counter_read() sums the slots, which makes reading cost one
+ * cache miss per CPU but keeps the total exact.
+ *
+ * Where rseq is unavailable each thread is assigned a slot round-robin
+ * and adds to it atomically, which stays contention-free as long as
+ * there are no more threads than CPUs.
+ *
+ * A read concurrent with updates sees each update either entirely or
+ * not at all; once updates stop it returns the exact total.
+ *
+ * Requires the GCC __atomic builtins and __thread.
+ */
+#ifndef PCPU_COUNTER_H_INCLUDED_
+#define PCPU_COUNTER_H_INCLUDED_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "rseq.h"
+
+#ifndef IMPL_CACHE_LINE
+#define IMPL_CACHE_LINE 64
+#endif
+
+struct impl_pcpu_slot {
+    int64_t cpu;     // updated inside restartable sequences on this CPU only
+    int64_t shared;  // updated atomically by threads without rseq
+} __attribute__((aligned(IMPL_CACHE_LINE)));
+
+typedef struct pcpu_counter {
+    struct impl_pcpu_slot *slots;
+    uint32_t nslots;
+} pcpu_counter_t;
+
+IMPL_THRD_GLOBAL unsigned impl_pcpu_next_slot;
+IMPL_THRD_GLOBAL __thread unsigned impl_pcpu_self_slot;  // index + 1, 0 if unassigned
+
+static inline int
+pcpu_counter_init(pcpu_counter_t *c)
+{
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    void *p;
+    assert(c != NULL);
+    if (n < 1)
+        n = 1;
+    if (posix_memalign(&p, IMPL_CACHE_LINE, n * sizeof(struct impl_pcpu_slot)) != 0)
+        return thrd_nomem;
+    memset(p, 0, n * sizeof(struct impl_pcpu_slot));
+    c->slots = (struct impl_pcpu_slot *)p;
+    c->nslots = (uint32_t)n;
+    return thrd_success;
+}
+
+static inline void
+pcpu_counter_destroy(pcpu_counter_t *c)
+{
+    assert(c != NULL);
+    free(c->slots);
+    c->slots = NULL;
+}
+
+static inline unsigned
+impl_pcpu_thread_slot(void)
+{
+    if (__builtin_expect(impl_pcpu_self_slot == 0, 0))
+        impl_pcpu_self_slot = __atomic_fetch_add(&impl_pcpu_next_slot, 1, __ATOMIC_RELAXED) + 1;
+    return impl_pcpu_self_slot - 1;
+}
+
+static inline void
+pcpu_counter_add(pcpu_counter_t *c, int64_t v)
+{
+    struct rseq_abi *rs = rseq_area();
+    if (__builtin_expect(rs != NULL, 1)) {
+        for (;;) {
+            uint32_t cpu = __atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+            if (cpu >= c->nslots)
+                break;  // CPU brought online after init
+            if (rseq_addv(rs, &c->slots[cpu].cpu, v, cpu) == 0)
+                return;
+        }
+    }
+    __atomic_fetch_add(&c->slots[impl_pcpu_thread_slot() % c->nslots].shared, v,
+                       __ATOMIC_RELAXED);
+}
+
+static inline void
+pcpu_counter_inc(pcpu_counter_t *c)
+{
+    pcpu_counter_add(c, 1);
+}
+
+static inline int64_t
+pcpu_counter_read(const pcpu_counter_t *c)
+{
+    int64_t sum = 0;
+    uint32_t i;
+    assert(c != NULL);
+    for (i = 0; i < c->nslots; i++) {
+        sum += __atomic_load_n(&c->slots[i].cpu, __ATOMIC_RELAXED);
+        sum += __atomic_load_n(&c->slots[i].shared, __ATOMIC_RELAXED);
+    }
+    return sum;
+}
+
+#endif /* PCPU_COUNTER_H_INCLUDED_ */
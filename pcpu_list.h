@@ -0,0 +1,170 @@
+/*
+ * Per-CPU LIFO lists, for free lists and object caches.
+ *
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file COPYING)
+ *
+ * Nodes are embedded in the caller's objects, as with mpsc_queue.h:
+ *
+ *     struct buf {
+ *         struct pcpu_node node;
+ *         char data[256];
+ *     };
+ *
+ *     pcpu_list_push(&cache, &b->node);
+ *     b = pcpu_list_entry(pcpu_list_pop(&cache), struct buf, node);
+ *
+ * Each CPU has its own list head, which pcpu_list_push() and
+ * pcpu_list_pop() update inside restartable sequences (see rseq.h):
+ * threads on different CPUs never touch the same cache line, and
+ * threads on the same CPU cannot interleave, so popping is free of the
+ * ABA problem without tags or reclamation schemes.
+ *
+ * Threads without rseq, and CPUs brought online after
+ * pcpu_list_init(), use one shared list guarded by an mtx_t instead.
+ * pcpu_list_pop() falls back to it when the current CPU's list is
+ * empty; it does not take nodes from other CPUs' lists.
+ *
+ * Requires the GCC __atomic builtins and __thread.
+ */
+#ifndef PCPU_LIST_H_INCLUDED_
+#define PCPU_LIST_H_INCLUDED_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "rseq.h"
+
+#ifndef IMPL_CACHE_LINE
+#define IMPL_CACHE_LINE 64
+#endif
+
+struct pcpu_node {
+    struct pcpu_node *next;
+};
+
+#define pcpu_list_entry(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct impl_pcpu_head {
+    struct pcpu_node *head;
+} __attribute__((aligned(IMPL_CACHE_LINE)));
+
+typedef struct pcpu_list {
+    struct impl_pcpu_head *heads;
+    uint32_t ncpus;
+    mtx_t mtx;
+    struct pcpu_node *shared;  // guarded by mtx
+} pcpu_list_t;
+
+static inline int
+pcpu_list_init(pcpu_list_t *l)
+{
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    void *p;
+    assert(l != NULL);
+    if (n < 1)
+        n = 1;
+    if (posix_memalign(&p, IMPL_CACHE_LINE, n * sizeof(struct impl_pcpu_head)) != 0)
+        return thrd_nomem;
+    memset(p, 0, n * sizeof(struct impl_pcpu_head));
+    if (mtx_init(&l->mtx, mtx_plain) != thrd_success) {
+        free(p);
+        return thrd_error;
+    }
+    l->heads = (struct impl_pcpu_head *)p;
+    l->ncpus = (uint32_t)n;
+    l->shared = NULL;
+    return thrd_success;
+}
+
+/* Nodes still on the list are left to the caller, see pcpu_list_drain(). */
+static inline void
+pcpu_list_destroy(pcpu_list_t *l)
+{
+    assert(l != NULL);
+    mtx_destroy(&l->mtx);
+    free(l->heads);
+    l->heads = NULL;
+}
+
+static inline void
+pcpu_list_push(pcpu_list_t *l, struct pcpu_node *node)
+{
+    struct rseq_abi *rs = rseq_area();
+    assert(node != NULL);
+    if (__builtin_expect(rs != NULL, 1)) {
+        for (;;) {
+            uint32_t cpu = __atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+            struct pcpu_node **head;
+            if (cpu >= l->ncpus)
+                break;
+            head = &l->heads[cpu].head;
+            node->next = *(struct pcpu_node *volatile *)head;
+            if (rseq_cmpeqv_storev(rs, (intptr_t *)head, (intptr_t)node->next,
+                                   (intptr_t)node, cpu) == 0)
+                return;
+        }
+    }
+    mtx_lock(&l->mtx);
+    node->next = l->shared;
+    l->shared = node;
+    mtx_unlock(&l->mtx);
+}
+
+/* Returns NULL if both the current CPU's list and the shared list are empty. */
+static inline struct pcpu_node *
+pcpu_list_pop(pcpu_list_t *l)
+{
+    struct rseq_abi *rs = rseq_area();
+    struct pcpu_node *node;
+    if (__builtin_expect(rs != NULL, 1)) {
+        for (;;) {
+            uint32_t cpu = __atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+            intptr_t popped;
+            int ret;
+            if (cpu >= l->ncpus)
+                break;
+            ret = rseq_cmpnev_storeoffp_load(rs, (intptr_t *)&l->heads[cpu].head, 0,
+                                             offsetof(struct pcpu_node, next),
+                                             &popped, cpu);
+            if (ret == 0)
+                return (struct pcpu_node *)popped;
+            if (ret > 0)
+                break;  // empty
+        }
+    }
+    if (!__atomic_load_n(&l->shared, __ATOMIC_RELAXED))
+        return NULL;
+    mtx_lock(&l->mtx);
+    node = l->shared;
+    if (node)
+        l->shared = node->next;
+    mtx_unlock(&l->mtx);
+    return node;
+}
+
+/*
+ * Removes every node from all lists and returns them chained through
+ * next. No other thread may use the list meanwhile.
+ */
+static inline struct pcpu_node *
+pcpu_list_drain(pcpu_list_t *l)
+{
+    struct pcpu_node *all = l->shared, *node, *next;
+    uint32_t i;
+    l->shared = NULL;
+    for (i = 0; i < l->ncpus; i++) {
+        for (node = l->heads[i].head; node; node = next) {
+            next = node->next;
+            node->next = all;
+            all = node;
+        }
+        l->heads[i].head = NULL;
+    }
+    return all;
+}
+
+#endif /* PCPU_LIST_H_INCLUDED_ */
@@ -0,0 +1,319 @@
+/*
+ * Userspace quiescent-state-based RCU (QSBR).
+ *
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file COPYING)
+ *
+ * Readers pay nothing inside their critical sections: rcu_read_lock()
+ * only registers a thread the first time it is called and
+ * rcu_read_unlock() is empty. Instead every
+ * reader thread periodically calls rcu_quiescent() at a point where it
+ * holds no RCU-protected pointers, typically once per iteration of its
+ * work loop. A grace period has elapsed when every online reader has
+ * passed a quiescent point:
+ *
+ *     reader                          updater
+ *     for (;;) {                      old = table;
+ *         rcu_read_lock();            rcu_assign_pointer(table, new);
+ *         t = rcu_dereference(table); synchronize_rcu();
+ *         ...                         free(old);
+ *         rcu_read_unlock();
+ *         rcu_quiescent();        or: call_rcu(&old->rcu, free_table);
+ *     }
+ *
+ * A thread registers on its first RCU call and is unregistered when it
+ * exits, whether it was started with thrd_create() or not; its first
+ * rcu_read_lock() must therefore precede its first protected read. A registered
+ * thread that stops calling rcu_quiescent() stalls every grace period,
+ * so threads must go offline with rcu_thread_offline() around long
+ * blocking calls and back online with rcu_thread_online() afterwards.
+ *
+ * call_rcu() callbacks run in a background thread started on first
+ * use, and may themselves use RCU; rcu_barrier() waits until all
+ * previously queued callbacks have run.
+ *
+ * Requires the GCC __atomic builtins and __thread.
+ */
+#ifndef RCU_H_INCLUDED_
+#define RCU_H_INCLUDED_
+
+#include <stdlib.h>
+#include "threads.h"
+#include "eventcount.h"
+
+#ifndef IMPL_CACHE_LINE
+#define IMPL_CACHE_LINE 64
+#endif
+#ifndef IMPL_THRD_GLOBAL
+#define IMPL_THRD_GLOBAL __attribute__((weak))
+#endif
+
+#define rcu_read_unlock() ((void)0)
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+};
+
+struct impl_rcu_reader {
+    unsigned long ctr;  // grace period last seen, 0 while offline
+    int in_use;
+    struct impl_rcu_reader *next;
+} __attribute__((aligned(IMPL_CACHE_LINE)));
+
+struct impl_rcu_state {
+    unsigned long gp_ctr;
+    struct impl_rcu_reader *readers;
+    mtx_t gp_mtx;  // serializes grace periods
+    tss_t key;
+    // call_rcu()
+    struct rcu_head *pending;
+    unsigned long queued;
+    unsigned long done;
+    eventcount_t work;
+    eventcount_t progress;
+};
+
+IMPL_THRD_GLOBAL struct impl_rcu_state impl_rcu;
+IMPL_THRD_GLOBAL once_flag impl_rcu_once = ONCE_FLAG_INIT;
+IMPL_THRD_GLOBAL once_flag impl_rcu_reclaimer_once = ONCE_FLAG_INIT;
+IMPL_THRD_GLOBAL __thread struct impl_rcu_reader *impl_rcu_self;
+
+static inline void
+impl_rcu_thread_exit(void *p)
+{
+    struct impl_rcu_reader *r = (struct impl_rcu_reader *)p;
+    __atomic_store_n(&r->ctr, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/* runs under call_once(), which cannot report failure */
+static inline void
+impl_rcu_init(void)
+{
+    impl_rcu.gp_ctr = 1;
+    if (mtx_init(&impl_rcu.gp_mtx, mtx_plain) != thrd_success
+        || tss_create(&impl_rcu.key, impl_rcu_thread_exit) != thrd_success
+        || eventcount_init(&impl_rcu.work) != thrd_success
+        || eventcount_init(&impl_rcu.progress) != thrd_success)
+        abort();
+}
+
+/* online: announce the current grace period before any further reads */
+static inline void
+impl_rcu_online(struct impl_rcu_reader *r)
+{
+    __atomic_store_n(&r->ctr, __atomic_load_n(&impl_rcu.gp_ctr, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline struct impl_rcu_reader *
+impl_rcu_register(void)
+{
+    struct impl_rcu_reader *r;
+
+    call_once(&impl_rcu_once, impl_rcu_init);
+    for (r = __atomic_load_n(&impl_rcu.readers, __ATOMIC_ACQUIRE); r; r = r->next) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&r->in_use, &expected, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (!r) {
+        r = (struct impl_rcu_reader *)calloc(1, sizeof(*r));
+        if (!r)
+            abort();
+        r->in_use = 1;
+        r->next = __atomic_load_n(&impl_rcu.readers, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&impl_rcu.readers, &r->next, r, 1,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            ;
+    }
+    impl_rcu_online(r);
+    tss_set(impl_rcu.key, r);
+    impl_rcu_self = r;
+    return r;
+}
+
+static inline void
+rcu_read_lock(void)
+{
+    if (__builtin_expect(!impl_rcu_self, 0))
+        impl_rcu_register();
+}
+
+/* registers the calling thread now rather than on its first RCU call */
+static inline void
+rcu_register_thread(void)
+{
+    if (!impl_rcu_self)
+        impl_rcu_register();
+}
+
+/* unregisters the calling thread before it exits */
+static inline void
+rcu_unregister_thread(void)
+{
+    struct impl_rcu_reader *r = impl_rcu_self;
+    if (!r)
+        return;
+    tss_set(impl_rcu.key, NULL);
+    impl_rcu_self = NULL;
+    impl_rcu_thread_exit(r);
+}
+
+static inline void
+rcu_quiescent(void)
+{
+    struct impl_rcu_reader *r = impl_rcu_self;
+    if (__builtin_expect(!r, 0)) {
+        impl_rcu_register();
+        return;
+    }
+    // all earlier reads are done before the updater can see the new count
+    __atomic_store_n(&r->ctr, __atomic_load_n(&impl_rcu.gp_ctr, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELEASE);
+}
+
+/* the thread holds no RCU pointers until rcu_thread_online() */
+static inline void
+rcu_thread_offline(void)
+{
+    struct impl_rcu_reader *r = impl_rcu_self;
+    if (r)
+        __atomic_store_n(&r->ctr, 0, __ATOMIC_RELEASE);
+}
+
+static inline void
+rcu_thread_online(void)
+{
+    struct impl_rcu_reader *r = impl_rcu_self;
+    if (r)
+        impl_rcu_online(r);
+    else
+        impl_rcu_register();
+}
+
+/*
+ * Waits until every reader online now has passed a quiescent point.
+ * The calling thread is offline for the duration.
+ */
+static inline void
+synchronize_rcu(void)
+{
+    struct impl_rcu_reader *self = impl_rcu_self, *r;
+    unsigned long target;
+    int online = self && __atomic_load_n(&self->ctr, __ATOMIC_RELAXED) != 0;
+
+    call_once(&impl_rcu_once, impl_rcu_init);
+    if (online)
+        rcu_thread_offline();
+    mtx_lock(&impl_rcu.gp_mtx);
+    target = __atomic_add_fetch(&impl_rcu.gp_ctr, 1, __ATOMIC_SEQ_CST);
+    for (r = __atomic_load_n(&impl_rcu.readers, __ATOMIC_SEQ_CST); r; r = r->next) {
+        unsigned spin = 0;
+        for (;;) {
+            unsigned long ctr = __atomic_load_n(&r->ctr, __ATOMIC_SEQ_CST);
+            if (ctr == 0 || ctr >= target)
+                break;
+            if (++spin < 64) {
+                thrd_yield();
+            } else {
+                struct timespec ts = { 0, 100000 };
+                thrd_sleep(&ts, NULL);
+            }
+        }
+    }
+    mtx_unlock(&impl_rcu.gp_mtx);
+    if (online)
+        rcu_thread_online();
+}
+
+static inline int
+impl_rcu_reclaimer(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        struct rcu_head *list, *next, *fifo = NULL;
+        unsigned long n = 0;
+
+        // callbacks may have registered this thread; don't stall grace periods
+        rcu_thread_offline();
+        while (!__atomic_load_n(&impl_rcu.pending, __ATOMIC_ACQUIRE)) {
+            unsigned key = eventcount_prepare(&impl_rcu.work);
+            if (__atomic_load_n(&impl_rcu.pending, __ATOMIC_ACQUIRE)) {
+                eventcount_cancel(&impl_rcu.work);
+                break;
+            }
+            eventcount_wait(&impl_rcu.work, key);
+        }
+        list = __atomic_exchange_n(&impl_rcu.pending, NULL, __ATOMIC_ACQUIRE);
+        for (; list; list = next) {
+            next = list->next;
+            list->next = fifo;
+            fifo = list;
+        }
+        synchronize_rcu();
+        for (; fifo; fifo = next, n++) {
+            next = fifo->next;
+            fifo->func(fifo);
+        }
+        __atomic_add_fetch(&impl_rcu.done, n, __ATOMIC_RELEASE);
+        eventcount_notify(&impl_rcu.progress);
+    }
+    return 0;
+}
+
+static inline void
+impl_rcu_reclaimer_start(void)
+{
+    thrd_t thr;
+    call_once(&impl_rcu_once, impl_rcu_init);
+    if (thrd_create(&thr, impl_rcu_reclaimer, NULL) != thrd_success)
+        abort();
+    thrd_detach(thr);
+}
+
+/* func(head) runs in the reclaimer thread after a grace period */
+static inline void
+call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+    assert(head != NULL && func != NULL);
+    call_once(&impl_rcu_reclaimer_once, impl_rcu_reclaimer_start);
+    head->func = func;
+    // count first, so that done never passes queued for a barrier to see
+    __atomic_add_fetch(&impl_rcu.queued, 1, __ATOMIC_RELAXED);
+    head->next = __atomic_load_n(&impl_rcu.pending, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&impl_rcu.pending, &head->next, head, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    eventcount_notify(&impl_rcu.work);
+}
+
+/* waits until the callbacks of all earlier call_rcu() have run */
+static inline void
+rcu_barrier(void)
+{
+    unsigned long target = __atomic_load_n(&impl_rcu.queued, __ATOMIC_RELAXED);
+    int online = impl_rcu_self && __atomic_load_n(&impl_rcu_self->ctr, __ATOMIC_RELAXED) != 0;
+
+    if (!target)
+        return;
+    if (online)
+        rcu_thread_offline();
+    while (__atomic_load_n(&impl_rcu.done, __ATOMIC_ACQUIRE) < target) {
+        unsigned key = eventcount_prepare(&impl_rcu.progress);
+        if (__atomic_load_n(&impl_rcu.done, __ATOMIC_ACQUIRE) >= target) {
+            eventcount_cancel(&impl_rcu.progress);
+            break;
+        }
+        eventcount_wait(&impl_rcu.progress, key);
+    }
+    if (online)
+        rcu_thread_online();
+}
+
+#endif /* RCU_H_INCLUDED_ */
@@ -0,0 +1,309 @@
+/*
+ * Restartable sequences (Linux rseq).
+ *
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file COPYING)
+ *
+ * A restartable sequence is a short stretch of code, ending in a
+ * single committing store, that the kernel restarts at an abort
+ * handler whenever the thread is preempted, migrated or interrupted by
+ * a signal before the commit. Code that runs to its commit therefore
+ * ran entirely on one CPU without interference, so per-CPU data can be
+ * updated with plain loads and stores instead of atomic instructions:
+ *
+ *     struct rseq_abi *rs = rseq_area();
+ *     do {
+ *         cpu = rs->cpu_id_start;
+ *         old = slot[cpu];
+ *     } while (rseq_cmpeqv_storev(rs, &slot[cpu], old, old + 1, cpu) != 0);
+ *
+ * Each thread must register an area with the kernel, in which the
+ * kernel publishes the current CPU number. glibc 2.35 and later
+ * registers every thread itself and exports the area's location. On
+ * older C libraries, or with glibc.pthread.rseq=0, threads started
+ * with thrd_create() register their own area when the program includes
+ * this header anywhere; other threads either call
+ * rseq_register_current_thread() or are registered on first use.
+ * rseq_area() returns NULL where neither works, callers then fall back
+ * to atomic operations.
+ *
+ * Implementation limits:
+ *   - Linux on x86-64 only; rseq_area() is always NULL elsewhere.
+ *   - Code that registers its own rseq area with another signature
+ *     makes this thread's registration fail.
+ *   - A thread registered by this header must call
+ *     rseq_unregister_current_thread() before the code including it is
+ *     unloaded, as the area is in that code's thread-local storage.
+ *   - Threads started with thrd_create() are registered at start only
+ *     by the emulation; with the C library's <threads.h> they are
+ *     registered by glibc 2.35 and later, and on first use before.
+ *
+ * Requires the GCC __atomic builtins and __thread.
+ */
+#ifndef RSEQ_H_INCLUDED_
+#define RSEQ_H_INCLUDED_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "threads.h"
+
+#ifndef IMPL_THRD_GLOBAL
+#define IMPL_THRD_GLOBAL __attribute__((weak))
+#endif
+
+#if defined(__linux__) && defined(__x86_64__)
+#define IMPL_RSEQ
+#endif
+
+/* struct rseq of <linux/rseq.h>, up to the fields used here */
+struct rseq_abi {
+    uint32_t cpu_id_start;  // always a valid CPU number once registered
+    uint32_t cpu_id;        // -1 before registration
+    uint64_t rseq_cs;       // critical section descriptor, set on entry
+    uint32_t flags;
+    uint32_t pad[3];
+} __attribute__((aligned(32)));
+
+#ifdef IMPL_RSEQ
+// must match the signature glibc registers
+#define IMPL_RSEQ_SIG 0x53053053
+#define IMPL_RSEQ_NR 334
+#define IMPL_RSEQ_FLAG_UNREGISTER 1
+
+// exported by glibc 2.35 and later
+extern const ptrdiff_t __rseq_offset __attribute__((weak));
+extern const unsigned int __rseq_size __attribute__((weak));
+
+IMPL_THRD_GLOBAL __thread struct rseq_abi impl_rseq_own;
+IMPL_THRD_GLOBAL __thread struct rseq_abi *impl_rseq_self;
+IMPL_THRD_GLOBAL __thread int impl_rseq_failed;
+
+static inline long
+impl_rseq_syscall(struct rseq_abi *area, uint32_t len, int flags, uint32_t sig)
+{
+    long ret;
+    register long r10 __asm__("r10") = (long)sig;
+    __asm__ __volatile__("syscall"
+                         : "=a"(ret)
+                         : "0"((long)IMPL_RSEQ_NR), "D"(area), "S"((long)len),
+                           "d"((long)flags), "r"(r10)
+                         : "rcx", "r11", "memory");
+    return ret;
+}
+
+static inline struct rseq_abi *
+impl_rseq_register(void)
+{
+    if (&__rseq_size != NULL && __rseq_size > 0) {
+        impl_rseq_self = (struct rseq_abi *)((char *)__builtin_thread_pointer() + __rseq_offset);
+    } else {
+        impl_rseq_own.cpu_id = (uint32_t)-1;
+        if (impl_rseq_syscall(&impl_rseq_own, sizeof(impl_rseq_own), 0, IMPL_RSEQ_SIG) == 0)
+            impl_rseq_self = &impl_rseq_own;
+        else
+            impl_rseq_failed = 1;
+    }
+    return impl_rseq_self;
+}
+#endif
+
+/* Returns the calling thread's registered rseq area, or NULL. */
+static inline struct rseq_abi *
+rseq_area(void)
+{
+#ifdef IMPL_RSEQ
+    if (__builtin_expect(impl_rseq_self != NULL, 1))
+        return impl_rseq_self;
+    if (impl_rseq_failed)
+        return NULL;
+    return impl_rseq_register();
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * Registers the calling thread if it is not yet. Returns thrd_success
+ * when the thread has an rseq area, thrd_error otherwise.
+ */
+static inline int
+rseq_register_current_thread(void)
+{
+    return rseq_area() ? thrd_success : thrd_error;
+}
+
+#ifdef __linux__
+/* Called by thrd_create()d threads before their start function, see threads_posix.h. */
+#ifdef __cplusplus
+extern "C"
+#endif
+IMPL_THRD_GLOBAL void
+impl_rseq_thrd_started(void)
+{
+    rseq_register_current_thread();
+}
+#endif
+
+/* Undoes a registration made by this header; the C library's is kept. */
+static inline void
+rseq_unregister_current_thread(void)
+{
+#ifdef IMPL_RSEQ
+    if (impl_rseq_self == &impl_rseq_own)
+        impl_rseq_syscall(&impl_rseq_own, sizeof(impl_rseq_own),
+                          IMPL_RSEQ_FLAG_UNREGISTER, IMPL_RSEQ_SIG);
+    impl_rseq_self = NULL;
+    impl_rseq_failed = 0;
+#endif
+}
+
+/*
+ * Makes rseq_area() return NULL in the calling thread from now on, so
+ * that callers take their fallback paths, e.g. to measure them.
+ */
+static inline void
+rseq_disable_current_thread(void)
+{
+    rseq_unregister_current_thread();
+#ifdef IMPL_RSEQ
+    impl_rseq_failed = 1;
+#endif
+}
+
+/*
+ * Returns the CPU the calling thread runs on, or -1 if unknown. The
+ * thread may have migrated by the time the caller looks at the result.
+ */
+static inline int
+thrd_current_cpu(void)
+{
+    struct rseq_abi *rs = rseq_area();
+    if (rs)
+        return (int)__atomic_load_n(&rs->cpu_id_start, __ATOMIC_RELAXED);
+    return -1;
+}
+
+/*
+ * Critical sections. Each of the following runs on CPU cpu only and
+ * returns -1, without having stored anything, if the calling thread is
+ * not on that CPU or was preempted, migrated or signalled; the caller
+ * then reads the CPU number again and retries. rs must be the calling
+ * thread's rseq_area().
+ *
+ * The descriptor records where the sequence starts (1), commits (2)
+ * and aborts to (4); the abort handler must be preceded by the
+ * signature and lie outside the sequence. A failed comparison jumps to
+ * 6.
+ */
+#ifdef IMPL_RSEQ
+#define IMPL_RSEQ_CS_BEGIN                                  \
+    ".pushsection __rseq_cs, \"aw\"\n\t"                    \
+    ".balign 32\n\t"                                        \
+    "3:\n\t"                                                \
+    ".long 0, 0\n\t"                                        \
+    ".quad 1f, (2f - 1f), 4f\n\t"                           \
+    ".popsection\n\t"                                       \
+    "leaq 3b(%%rip), %%rax\n\t"                             \
+    "movq %%rax, %[rseq_cs]\n\t"                            \
+    "1:\n\t"                                                \
+    "cmpl %[cpu], %[cpu_id]\n\t"                            \
+    "jnz 4f\n\t"
+
+#define IMPL_RSEQ_CS_END                                    \
+    "2:\n\t"                                                \
+    "xorl %[ret], %[ret]\n\t"                               \
+    "jmp 5f\n\t"                                            \
+    "6:\n\t"                                                \
+    "movl $1, %[ret]\n\t"                                   \
+    "jmp 5f\n\t"                                            \
+    ".pushsection __rseq_failure, \"ax\"\n\t"               \
+    ".byte 0x0f, 0xb9, 0x3d\n\t"  /* ud1 */                 \
+    ".long 0x53053053\n\t"                                  \
+    "4:\n\t"                                                \
+    "movl $-1, %[ret]\n\t"                                  \
+    "jmp 5f\n\t"                                            \
+    ".popsection\n\t"                                       \
+    "5:\n\t"
+#endif
+
+/* *v += count. Returns 0 or -1. */
+static inline int
+rseq_addv(struct rseq_abi *rs, int64_t *v, int64_t count, uint32_t cpu)
+{
+#ifdef IMPL_RSEQ
+    int ret;
+    __asm__ __volatile__(
+        IMPL_RSEQ_CS_BEGIN
+        "addq %[count], %[v]\n\t"
+        IMPL_RSEQ_CS_END
+        : [ret] "=&r"(ret), [rseq_cs] "=m"(rs->rseq_cs), [v] "+m"(*v)
+        : [cpu] "r"(cpu), [cpu_id] "m"(rs->cpu_id), [count] "er"(count)
+        : "rax", "memory", "cc");
+    return ret;
+#else
+    (void)rs; (void)v; (void)count; (void)cpu;
+    return -1;
+#endif
+}
+
+/*
+ * If *v == expect, *v = newv. Returns 0 when stored, 1 when *v differed
+ * and -1 when aborted.
+ */
+static inline int
+rseq_cmpeqv_storev(struct rseq_abi *rs, intptr_t *v, intptr_t expect,
+                   intptr_t newv, uint32_t cpu)
+{
+#ifdef IMPL_RSEQ
+    int ret;
+    __asm__ __volatile__(
+        IMPL_RSEQ_CS_BEGIN
+        "cmpq %[v], %[expect]\n\t"
+        "jnz 6f\n\t"
+        "movq %[newv], %[v]\n\t"
+        IMPL_RSEQ_CS_END
+        : [ret] "=&r"(ret), [rseq_cs] "=m"(rs->rseq_cs), [v] "+m"(*v)
+        : [cpu] "r"(cpu), [cpu_id] "m"(rs->cpu_id), [expect] "r"(expect),
+          [newv] "r"(newv)
+        : "rax", "memory", "cc");
+    return ret;
+#else
+    (void)rs; (void)v; (void)expect; (void)newv; (void)cpu;
+    return -1;
+#endif
+}
+
+/*
+ * If *v != expectnot, *load = *v and *v = *(intptr_t *)(*v + voffp):
+ * pops the head of a list whose link is voffp bytes into each node.
+ * Returns 0 when stored, 1 when *v == expectnot and -1 when aborted.
+ */
+static inline int
+rseq_cmpnev_storeoffp_load(struct rseq_abi *rs, intptr_t *v, intptr_t expectnot,
+                           long voffp, intptr_t *load, uint32_t cpu)
+{
+#ifdef IMPL_RSEQ
+    int ret;
+    __asm__ __volatile__(
+        IMPL_RSEQ_CS_BEGIN
+        "movq %[v], %%rax\n\t"
+        "cmpq %%rax, %[expectnot]\n\t"
+        "je 6f\n\t"
+        "movq %%rax, %[load]\n\t"
+        "addq %[voffp], %%rax\n\t"
+        "movq (%%rax), %%rax\n\t"
+        "movq %%rax, %[v]\n\t"
+        IMPL_RSEQ_CS_END
+        : [ret] "=&r"(ret), [rseq_cs] "=m"(rs->rseq_cs), [v] "+m"(*v),
+          [load] "=m"(*load)
+        : [cpu] "r"(cpu), [cpu_id] "m"(rs->cpu_id), [expectnot] "r"(expectnot),
+          [voffp] "er"(voffp)
+        : "rax", "memory", "cc");
+    return ret;
+#else
+    (void)rs; (void)v; (void)expectnot; (void)voffp; (void)load; (void)cpu;
+    return -1;
+#endif
+}
+
+#endif /* RSEQ_H_INCLUDED_ */
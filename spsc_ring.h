@@ -0,0 +1,190 @@
+/*
+ * Wait-free single-producer/single-consumer ring of pointers.
+ *
+ * Distributed under the Boost Software License, Version 1.0.
+ * (See accompanying file COPYING)
+ *
+ * The producer owns head and the consumer owns tail, each on its own
+ * cache line together with a private copy of the other side's index.
+ * The shared index is only re-read when the copy says the ring is full
+ * (or empty), so in steady state each side touches the other's line
+ * once per lap rather than once per item. push_n/pop_n move a batch
+ * with a single index publication.
+ *
+ * Rings created with SPSC_RING_BLOCKING additionally support the
+ * blocking spsc_ring_push()/spsc_ring_pop(); every transfer then pays a
+ * fence to check for a parked peer.
+ *
+ * Requires the GCC __atomic builtins.
+ */
+#ifndef SPSC_RING_H_INCLUDED_
+#define SPSC_RING_H_INCLUDED_
+
+#include <stddef.h>
+#include "threads.h"
+#include "eventcount.h"
+
+#ifndef IMPL_CACHE_LINE
+#define IMPL_CACHE_LINE 64
+#endif
+
+enum {
+    SPSC_RING_BLOCKING = 1
+};
+
+typedef struct {
+    void **items;
+    size_t mask;
+    int flags;
+    // producer side
+    size_t head __attribute__((aligned(IMPL_CACHE_LINE)));
+    size_t tail_cache;
+    // consumer side
+    size_t tail __attribute__((aligned(IMPL_CACHE_LINE)));
+    size_t head_cache;
+    eventcount_t not_empty __attribute__((aligned(IMPL_CACHE_LINE)));
+    eventcount_t not_full;
+} spsc_ring_t;
+
+/* capacity is rounded up to a power of two, at least 2 */
+static inline int
+spsc_ring_init(spsc_ring_t *r, size_t capacity, int flags)
+{
+    size_t size = 2;
+    assert(r != NULL);
+    while (size < capacity)
+        size <<= 1;
+    r->items = (void **)malloc(size * sizeof(r->items[0]));
+    if (!r->items)
+        return thrd_nomem;
+    r->mask = size - 1;
+    r->flags = flags;
+    r->head = r->tail_cache = 0;
+    r->tail = r->head_cache = 0;
+    if (flags & SPSC_RING_BLOCKING) {
+        if (eventcount_init(&r->not_empty) != thrd_success) {
+            free(r->items);
+            return thrd_error;
+        }
+        if (eventcount_init(&r->not_full) != thrd_success) {
+            eventcount_destroy(&r->not_empty);
+            free(r->items);
+            return thrd_error;
+        }
+    }
+    return thrd_success;
+}
+
+static inline void
+spsc_ring_destroy(spsc_ring_t *r)
+{
+    assert(r != NULL);
+    if (r->flags & SPSC_RING_BLOCKING) {
+        eventcount_destroy(&r->not_full);
+        eventcount_destroy(&r->not_empty);
+    }
+    free(r->items);
+}
+
+/* producer only: pushes up to n items, returns how many */
+static inline size_t
+spsc_ring_push_n(spsc_ring_t *r, void *const *items, size_t n)
+{
+    size_t head = r->head, room, i;
+    room = r->tail_cache + r->mask + 1 - head;
+    if (room < n) {
+        r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        room = r->tail_cache + r->mask + 1 - head;
+        if (room < n)
+            n = room;
+    }
+    if (n == 0)
+        return 0;
+    for (i = 0; i < n; i++)
+        r->items[(head + i) & r->mask] = items[i];
+    __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+    if (r->flags & SPSC_RING_BLOCKING)
+        eventcount_notify(&r->not_empty);
+    return n;
+}
+
+/* consumer only: pops up to max items, returns how many */
+static inline size_t
+spsc_ring_pop_n(spsc_ring_t *r, void **items, size_t max)
+{
+    size_t tail = r->tail, avail, i;
+    avail = r->head_cache - tail;
+    if (avail < max) {
+        r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        avail = r->head_cache - tail;
+        if (avail < max)
+            max = avail;
+    }
+    if (max == 0)
+        return 0;
+    for (i = 0; i < max; i++)
+        items[i] = r->items[(tail + i) & r->mask];
+    __atomic_store_n(&r->tail, tail + max, __ATOMIC_RELEASE);
+    if (r->flags & SPSC_RING_BLOCKING)
+        eventcount_notify(&r->not_full);
+    return max;
+}
+
+/* returns thrd_busy when the ring is full */
+static inline int
+spsc_ring_try_push(spsc_ring_t *r, void *item)
+{
+    return spsc_ring_push_n(r, &item, 1) ? thrd_success : thrd_busy;
+}
+
+/* returns thrd_busy when the ring is empty */
+static inline int
+spsc_ring_try_pop(spsc_ring_t *r, void **item)
+{
+    assert(item != NULL);
+    return spsc_ring_pop_n(r, item, 1) ? thrd_success : thrd_busy;
+}
+
+static inline int
+spsc_ring_push(spsc_ring_t *r, void *item)
+{
+    int spin;
+    assert(r->flags & SPSC_RING_BLOCKING);
+    for (spin = 0; spin < EVENTCOUNT_SPIN; spin++) {
+        if (spsc_ring_try_push(r, item) == thrd_success)
+            return thrd_success;
+        impl_eventcount_pause();
+    }
+    while (spsc_ring_try_push(r, item) != thrd_success) {
+        unsigned key = eventcount_prepare(&r->not_full);
+        if (spsc_ring_try_push(r, item) == thrd_success) {
+            eventcount_cancel(&r->not_full);
+            break;
+        }
+        eventcount_wait(&r->not_full, key);
+    }
+    return thrd_success;
+}
+
+static inline int
+spsc_ring_pop(spsc_ring_t *r, void **item)
+{
+    int spin;
+    assert(r->flags & SPSC_RING_BLOCKING);
+    for (spin = 0; spin < EVENTCOUNT_SPIN; spin++) {
+        if (spsc_ring_try_pop(r, item) == thrd_success)
+            return thrd_success;
+        impl_eventcount_pause();
+    }
+    while (spsc_ring_try_pop(r, item) != thrd_success) {
+        unsigned key = eventcount_prepare(&r->not_empty);
+        if (spsc_ring_try_pop(r, item) == thrd_success) {
+            eventcount_cancel(&r->not_empty);
+            break;
+        }
+        eventcount_wait(&r->not_empty, key);
+    }
+    return thrd_success;
+}
+
+#endif /* SPSC_RING_H_INCLUDED_ */
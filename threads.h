@@ -26,6 +26,14 @@
  * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
  * DEALINGS IN THE SOFTWARE.
  */
+#ifdef IMPL_THRD_NATIVE_NEXT
+/*
+ * Reached through the #include_next below after this header was found
+ * relative to its includer rather than through the include path; pass
+ * on to the next threads.h in the path.
+ */
+#include_next <threads.h>
+#else
 #ifndef EMULATED_THREADS_H_INCLUDED_
 #define EMULATED_THREADS_H_INCLUDED_
 
@@ -35,8 +43,47 @@
 #define TIME_UTC 1
 #endif
 
+/* C2x time bases, values match glibc's <time.h> */
+#ifndef TIME_MONOTONIC
+#define TIME_MONOTONIC 2
+#endif
+#ifndef TIME_ACTIVE
+#define TIME_ACTIVE 3
+#endif
+#ifndef TIME_THREAD_ACTIVE
+#define TIME_THREAD_ACTIVE 4
+#endif
+
 #include "c99_compat.h" /* for `inline` */
 
+/*
+ * glibc 2.28 and later implement <threads.h> natively. On request, use
+ * it and keep only the extensions of this library on top, unless the
+ * instrumentation modes need to wrap the standard functions themselves.
+ * This changes the types and the values of thrd_busy and thrd_timeout,
+ * so it is never the default.
+ */
+#if defined(HAVE_PTHREAD) && !defined(_WIN32) && defined(__GLIBC__) \
+    && defined(EMULATED_THREADS_USE_NATIVE_C11) \
+    && !defined(EMULATED_THREADS_PROFILE_LOCKS) && !defined(EMULATED_THREADS_PROFILE_HOLD) \
+    && !defined(EMULATED_THREADS_TRACE) && !defined(EMULATED_THREADS_USDT) \
+    && !defined(EMULATED_THREADS_STATS) && !defined(EMULATED_THREADS_WAIT_STATS)
+#if __GLIBC_PREREQ(2, 28)
+#define IMPL_THRD_NATIVE
+#endif
+#endif
+
+#ifdef IMPL_THRD_NATIVE
+#define IMPL_THRD_NATIVE_NEXT
+#include_next <threads.h>
+#undef IMPL_THRD_NATIVE_NEXT
+#ifndef _THREADS_H
+#error "threads.h: the C library's <threads.h> was not found, undefine EMULATED_THREADS_USE_NATIVE_C11"
+#endif
+
+// the name this library has always used for the standard thrd_timedout
+#define thrd_timeout thrd_timedout
+#else
 /*---------------------------- types ----------------------------*/
 typedef void (*tss_dtor_t)(void*);
 typedef int (*thrd_start_t)(void*);
@@ -57,6 +104,7 @@ enum {
     thrd_busy,        // resource busy
     thrd_nomem        // out of memory
 };
+#endif
 
 /*-------------------------- functions --------------------------*/
 
@@ -71,3 +119,4 @@ enum {
 
 
 #endif /* EMULATED_THREADS_H_INCLUDED_ */
+#endif /* IMPL_THRD_NATIVE_NEXT */
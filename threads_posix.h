@@ -35,6 +35,8 @@
 #include <unistd.h>
 #include <sched.h>
 #include <stdint.h> /* for intptr_t */
+#include <stdio.h>
+#include <string.h>
 
 /*
 Configuration macro:
@@ -42,6 +44,29 @@ Configuration macro:
   EMULATED_THREADS_USE_NATIVE_TIMEDLOCK
     Use pthread_mutex_timedlock() for `mtx_timedlock()'
     Otherwise use mtx_trylock() + *busy loop* emulation.
+
+  EMULATED_THREADS_NO_CYCLE_CLOCK
+    Never read the CPU cycle counter in `thrd_clock_now()'.
+    Otherwise the invariant TSC (x86-64) or CNTVCT (AArch64) is used
+    when available, and clock_gettime(CLOCK_MONOTONIC) when not.
+
+  EMULATED_THREADS_SPIN_SLEEP_NS
+    Length of the final busy-wait in `thrd_sleep_precise()'.
+    Defaults to 30us; the preceding part of the interval is slept.
+
+  EMULATED_THREADS_USE_NATIVE_C11
+    Use the C library's <threads.h> on glibc 2.28 and later, with only
+    the non-standard extensions defined here. Its types and its values
+    of thrd_busy and thrd_timeout differ from the emulation's, so code
+    built with and without this macro must not be mixed. The system
+    header is reached with #include_next, so its directory must follow
+    this one's in the include path.
+    Ignored when any instrumentation mode below is enabled.
+
+  EMULATED_THREADS_PROFILE_LOCKS
+    Record how often and how long threads wait for each mutex, see
+    `thrd_profile_dump()'. mtx_lock() then tries the lock first and
+    only reads the clock when that fails.
 */
 #if !defined(__CYGWIN__) && !defined(__APPLE__) && !defined(__NetBSD__)
 #define EMULATED_THREADS_USE_NATIVE_TIMEDLOCK
@@ -49,8 +74,48 @@ Configuration macro:
 
 
 #include <pthread.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#if defined(EMULATED_THREADS_PROFILE_LOCKS) || defined(EMULATED_THREADS_PROFILE_HOLD) \
+    || defined(EMULATED_THREADS_TRACE) || defined(EMULATED_THREADS_USDT) \
+    || defined(EMULATED_THREADS_STATS) || defined(EMULATED_THREADS_WAIT_STATS)
+#define IMPL_THRD_MTX_HOOKS
+#define IMPL_THRD_MTX_NAMES
+#endif
+#if defined(EMULATED_THREADS_PROFILE_HOLD) || defined(EMULATED_THREADS_TRACE) \
+    || defined(EMULATED_THREADS_USDT) || defined(EMULATED_THREADS_STATS) \
+    || defined(EMULATED_THREADS_WAIT_STATS)
+#define IMPL_THRD_CND_HOOKS
+#endif
+#if defined(EMULATED_THREADS_TRACE) || defined(EMULATED_THREADS_USDT) \
+    || defined(EMULATED_THREADS_STATS) || defined(EMULATED_THREADS_WAIT_STATS)
+#define IMPL_THRD_THRD_HOOKS
+#endif
+
+/*
+ * Timestamps taken around contended locks and condvar waits; 0 unless
+ * a mode compiled in consumes them, so that counting alone stays cheap.
+ */
+#if defined(EMULATED_THREADS_PROFILE_LOCKS) || defined(EMULATED_THREADS_TRACE) \
+    || defined(EMULATED_THREADS_WAIT_STATS)
+#define IMPL_THRD_MTX_CLOCK() thrd_clock_now()
+#elif defined(EMULATED_THREADS_USDT)
+// only the mtx_contend_end probe needs the wait time
+#define IMPL_THRD_MTX_CLOCK() \
+    (IMPL_THRD_PROBE_ENABLED(mtx_contend_end) ? thrd_clock_now() : (uint64_t)0)
+#else
+#define IMPL_THRD_MTX_CLOCK() ((uint64_t)0)
+#endif
+#if defined(EMULATED_THREADS_TRACE) || defined(EMULATED_THREADS_WAIT_STATS)
+#define IMPL_THRD_CND_CLOCK() thrd_clock_now()
+#else
+#define IMPL_THRD_CND_CLOCK() ((uint64_t)0)
+#endif
 
 /*---------------------------- macros ----------------------------*/
+#ifndef IMPL_THRD_NATIVE
 #define ONCE_FLAG_INIT PTHREAD_ONCE_INIT
 #ifdef INIT_ONCE_STATIC_INIT
 #define TSS_DTOR_ITERATIONS PTHREAD_DESTRUCTOR_ITERATIONS
@@ -60,7 +125,75 @@ Configuration macro:
 
 // FIXME: temporary non-standard hack to ease transition
 #define _MTX_INITIALIZER_NP PTHREAD_MUTEX_INITIALIZER
+#else
+// glibc's mtx_t is all zeros when statically initialized
+#define _MTX_INITIALIZER_NP { { 0 } }
+#endif
+
+/*
+ * Process-wide state used by the extensions. Weak so that every
+ * translation unit including this header shares a single definition.
+ */
+#define IMPL_THRD_GLOBAL __attribute__((weak))
+
+/*
+ * USDT probes. The semaphore of a probe is non-zero while a tracer is
+ * attached to it; probes whose arguments cost anything to compute are
+ * guarded by IMPL_THRD_PROBE_ENABLED(), all others are a single nop.
+ */
+#ifdef EMULATED_THREADS_USDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define IMPL_THRD_PROBE_SEMAPHORE(name) \
+    IMPL_THRD_GLOBAL __attribute__((section(".probes"))) \
+    volatile unsigned short c11threads_##name##_semaphore
+#define IMPL_THRD_PROBE_ENABLED(name) \
+    __builtin_expect(c11threads_##name##_semaphore != 0, 0)
+#define IMPL_THRD_PROBE0(name) STAP_PROBE(c11threads, name)
+#define IMPL_THRD_PROBE1(name, a) STAP_PROBE1(c11threads, name, a)
+#define IMPL_THRD_PROBE2(name, a, b) STAP_PROBE2(c11threads, name, a, b)
+#define IMPL_THRD_PROBE3(name, a, b, c) STAP_PROBE3(c11threads, name, a, b, c)
+
+IMPL_THRD_PROBE_SEMAPHORE(thrd_create);
+IMPL_THRD_PROBE_SEMAPHORE(thrd_start);
+IMPL_THRD_PROBE_SEMAPHORE(thrd_exit);
+IMPL_THRD_PROBE_SEMAPHORE(mtx_acquire);
+IMPL_THRD_PROBE_SEMAPHORE(mtx_release);
+IMPL_THRD_PROBE_SEMAPHORE(mtx_busy);
+IMPL_THRD_PROBE_SEMAPHORE(mtx_contend_begin);
+IMPL_THRD_PROBE_SEMAPHORE(mtx_contend_end);
+IMPL_THRD_PROBE_SEMAPHORE(cnd_signal);
+IMPL_THRD_PROBE_SEMAPHORE(cnd_broadcast);
+IMPL_THRD_PROBE_SEMAPHORE(cnd_wait_begin);
+IMPL_THRD_PROBE_SEMAPHORE(cnd_wait_end);
+IMPL_THRD_PROBE_SEMAPHORE(tss_create);
+IMPL_THRD_PROBE_SEMAPHORE(tss_delete);
+IMPL_THRD_PROBE_SEMAPHORE(tss_get);
+IMPL_THRD_PROBE_SEMAPHORE(tss_set);
+#else
+#define IMPL_THRD_PROBE_ENABLED(name) 0
+#define IMPL_THRD_PROBE0(name) ((void)0)
+#define IMPL_THRD_PROBE1(name, a) ((void)0)
+#define IMPL_THRD_PROBE2(name, a, b) ((void)0)
+#define IMPL_THRD_PROBE3(name, a, b, c) ((void)0)
+#endif
+
+/*
+ * With USDT probes as the only instrumentation, the mutex functions keep
+ * their plain pthread paths until a tracer attaches to a mutex probe.
+ */
+#if defined(EMULATED_THREADS_USDT) && !defined(EMULATED_THREADS_PROFILE_LOCKS) \
+    && !defined(EMULATED_THREADS_PROFILE_HOLD) && !defined(EMULATED_THREADS_TRACE) \
+    && !defined(EMULATED_THREADS_STATS) && !defined(EMULATED_THREADS_WAIT_STATS)
+#define IMPL_THRD_MTX_HOOKED() \
+    __builtin_expect((c11threads_mtx_acquire_semaphore | c11threads_mtx_release_semaphore \
+                      | c11threads_mtx_busy_semaphore | c11threads_mtx_contend_begin_semaphore \
+                      | c11threads_mtx_contend_end_semaphore) != 0, 0)
+#else
+#define IMPL_THRD_MTX_HOOKED() 1
+#endif
 
+#ifndef IMPL_THRD_NATIVE
 /*---------------------------- types ----------------------------*/
 typedef pthread_cond_t  cnd_t;
 typedef pthread_t       thrd_t;
@@ -79,14 +212,75 @@ struct impl_thrd_param {
     void *arg;
 };
 
+#ifdef IMPL_THRD_THRD_HOOKS
+static inline void impl_thrd_created(thrd_t thr);
+static inline void impl_thrd_started(void);
+static inline void impl_thrd_exiting(int res);
+#endif
+
+#ifdef __linux__
+/* Registers the new thread for rseq; defined if any unit includes rseq.h. */
+#ifdef __cplusplus
+extern "C"
+#endif
+void impl_rseq_thrd_started(void) __attribute__((weak));
+#endif
+
 static inline void *
 impl_thrd_routine(void *p)
 {
     struct impl_thrd_param pack = *((struct impl_thrd_param *)p);
     free(p);
+#ifdef __linux__
+    if (impl_rseq_thrd_started)
+        impl_rseq_thrd_started();
+#endif
+#ifdef IMPL_THRD_THRD_HOOKS
+    {
+    int res;
+    impl_thrd_started();
+    res = pack.func(pack.arg);
+    impl_thrd_exiting(res);
+    return (void*)(intptr_t)res;
+    }
+#else
     return (void*)(intptr_t)pack.func(pack.arg);
+#endif
 }
 
+#ifdef EMULATED_THREADS_WAIT_STATS
+enum {
+    IMPL_WAIT_MTX,
+    IMPL_WAIT_CND,
+    IMPL_WAIT_SLEEP,
+    IMPL_WAIT_JOIN
+};
+
+static inline uint64_t thrd_clock_now(void);
+static inline void impl_wait_stats_add(int kind, uint64_t ns);
+static inline struct impl_wait_rec *impl_wait_rec_get(void);
+#endif
+
+#ifdef IMPL_THRD_CND_HOOKS
+struct impl_cnd_wait {
+    uint64_t t0;
+    uint64_t hold_ns;
+};
+
+static inline void impl_cnd_wait_begin(struct impl_cnd_wait *w, cnd_t *cond, mtx_t *mtx);
+static inline void impl_cnd_wait_end(struct impl_cnd_wait *w, cnd_t *cond, mtx_t *mtx, int rt);
+#endif
+
+#ifdef IMPL_THRD_MTX_HOOKS
+static inline uint64_t thrd_clock_now(void);
+static inline void impl_mtx_contend_begin(mtx_t *mtx);
+static inline void impl_mtx_contended(mtx_t *mtx, uint64_t t0, uint64_t t1);
+static inline void impl_mtx_trylock_failed(mtx_t *mtx);
+static inline void impl_mtx_acquired(mtx_t *mtx);
+static inline uint64_t impl_mtx_release_begin(mtx_t *mtx);
+static inline void impl_mtx_release_end(mtx_t *mtx, uint64_t hold_ns, int relocked);
+#endif
+
 
 /*--------------- 7.25.2 Initialization functions ---------------*/
 // 7.25.2.1
@@ -103,6 +297,7 @@ static inline int
 cnd_broadcast(cnd_t *cond)
 {
     assert(cond != NULL);
+    IMPL_THRD_PROBE1(cnd_broadcast, cond);
     return (pthread_cond_broadcast(cond) == 0) ? thrd_success : thrd_error;
 }
 
@@ -127,6 +322,7 @@ static inline int
 cnd_signal(cnd_t *cond)
 {
     assert(cond != NULL);
+    IMPL_THRD_PROBE1(cnd_signal, cond);
     return (pthread_cond_signal(cond) == 0) ? thrd_success : thrd_error;
 }
 
@@ -140,7 +336,16 @@ cnd_timedwait(cnd_t *cond, mtx_t *mtx, const struct timespec *abs_time)
     assert(cond != NULL);
     assert(abs_time != NULL);
 
+#ifdef IMPL_THRD_CND_HOOKS
+    {
+    struct impl_cnd_wait w;
+    impl_cnd_wait_begin(&w, cond, mtx);
+    rt = pthread_cond_timedwait(cond, mtx, abs_time);
+    impl_cnd_wait_end(&w, cond, mtx, rt);
+    }
+#else
     rt = pthread_cond_timedwait(cond, mtx, abs_time);
+#endif
     if (rt == ETIMEDOUT)
         return thrd_busy;
     return (rt == 0) ? thrd_success : thrd_error;
@@ -152,16 +357,34 @@ cnd_wait(cnd_t *cond, mtx_t *mtx)
 {
     assert(mtx != NULL);
     assert(cond != NULL);
+#ifdef IMPL_THRD_CND_HOOKS
+    {
+    int rt;
+    struct impl_cnd_wait w;
+    impl_cnd_wait_begin(&w, cond, mtx);
+    rt = pthread_cond_wait(cond, mtx);
+    impl_cnd_wait_end(&w, cond, mtx, rt);
+    return (rt == 0) ? thrd_success : thrd_error;
+    }
+#else
     return (pthread_cond_wait(cond, mtx) == 0) ? thrd_success : thrd_error;
+#endif
 }
 
 
 /*-------------------- 7.25.4 Mutex functions --------------------*/
 // 7.25.4.1
+#ifdef IMPL_THRD_MTX_NAMES
+static inline void impl_mtx_drop_name(mtx_t *mtx);
+#endif
+
 static inline void
 mtx_destroy(mtx_t *mtx)
 {
     assert(mtx != NULL);
+#ifdef IMPL_THRD_MTX_NAMES
+    impl_mtx_drop_name(mtx);
+#endif
     pthread_mutex_destroy(mtx);
 }
 
@@ -220,6 +443,22 @@ static inline int
 mtx_lock(mtx_t *mtx)
 {
     assert(mtx != NULL);
+#ifdef IMPL_THRD_MTX_HOOKS
+    if (IMPL_THRD_MTX_HOOKED()) {
+        if (pthread_mutex_trylock(mtx) != 0) {
+            uint64_t t0;
+            int rt;
+            impl_mtx_contend_begin(mtx);
+            t0 = IMPL_THRD_MTX_CLOCK();
+            rt = pthread_mutex_lock(mtx);
+            impl_mtx_contended(mtx, t0, IMPL_THRD_MTX_CLOCK());
+            if (rt != 0)
+                return thrd_error;
+        }
+        impl_mtx_acquired(mtx);
+        return thrd_success;
+    }
+#endif
     return (pthread_mutex_lock(mtx) == 0) ? thrd_success : thrd_error;
 }
 
@@ -229,14 +468,9 @@ mtx_trylock(mtx_t *mtx);
 static inline void
 thrd_yield(void);
 
-// 7.25.4.4
 static inline int
-mtx_timedlock(mtx_t *mtx, const struct timespec *ts)
+impl_mtx_timedlock_wait(mtx_t *mtx, const struct timespec *ts)
 {
-    assert(mtx != NULL);
-    assert(ts != NULL);
-
-    {
 #ifdef EMULATED_THREADS_USE_NATIVE_TIMEDLOCK
     int rt;
     rt = pthread_mutex_timedlock(mtx, ts);
@@ -246,7 +480,7 @@ mtx_timedlock(mtx_t *mtx, const struct timespec *ts)
 #else
     time_t expire = time(NULL);
     expire += ts->tv_sec;
-    while (mtx_trylock(mtx) != thrd_success) {
+    while (pthread_mutex_trylock(mtx) != 0) {
         time_t now = time(NULL);
         if (expire < now)
             return thrd_busy;
@@ -255,7 +489,32 @@ mtx_timedlock(mtx_t *mtx, const struct timespec *ts)
     }
     return thrd_success;
 #endif
+}
+
+// 7.25.4.4
+static inline int
+mtx_timedlock(mtx_t *mtx, const struct timespec *ts)
+{
+    assert(mtx != NULL);
+    assert(ts != NULL);
+
+#ifdef IMPL_THRD_MTX_HOOKS
+    if (IMPL_THRD_MTX_HOOKED()) {
+        if (pthread_mutex_trylock(mtx) != 0) {
+            uint64_t t0;
+            int rt;
+            impl_mtx_contend_begin(mtx);
+            t0 = IMPL_THRD_MTX_CLOCK();
+            rt = impl_mtx_timedlock_wait(mtx, ts);
+            impl_mtx_contended(mtx, t0, IMPL_THRD_MTX_CLOCK());
+            if (rt != thrd_success)
+                return rt;
+        }
+        impl_mtx_acquired(mtx);
+        return thrd_success;
     }
+#endif
+    return impl_mtx_timedlock_wait(mtx, ts);
 }
 
 // 7.25.4.5
@@ -263,6 +522,16 @@ static inline int
 mtx_trylock(mtx_t *mtx)
 {
     assert(mtx != NULL);
+#ifdef IMPL_THRD_MTX_HOOKS
+    if (IMPL_THRD_MTX_HOOKED()) {
+        if (pthread_mutex_trylock(mtx) == 0) {
+            impl_mtx_acquired(mtx);
+            return thrd_success;
+        }
+        impl_mtx_trylock_failed(mtx);
+        return thrd_busy;
+    }
+#endif
     return (pthread_mutex_trylock(mtx) == 0) ? thrd_success : thrd_busy;
 }
 
@@ -271,6 +540,15 @@ static inline int
 mtx_unlock(mtx_t *mtx)
 {
     assert(mtx != NULL);
+#ifdef IMPL_THRD_MTX_HOOKS
+    if (IMPL_THRD_MTX_HOOKED()) {
+        uint64_t hold = impl_mtx_release_begin(mtx);
+        if (pthread_mutex_unlock(mtx) != 0)
+            return thrd_error;
+        impl_mtx_release_end(mtx, hold, 0);
+        return thrd_success;
+    }
+#endif
     return (pthread_mutex_unlock(mtx) == 0) ? thrd_success : thrd_error;
 }
 
@@ -290,6 +568,9 @@ thrd_create(thrd_t *thr, thrd_start_t func, void *arg)
         free(pack);
         return thrd_error;
     }
+#ifdef IMPL_THRD_THRD_HOOKS
+    impl_thrd_created(*thr);
+#endif
     return thrd_success;
 }
 
@@ -318,6 +599,9 @@ thrd_equal(thrd_t thr0, thrd_t thr1)
 static inline void
 thrd_exit(int res)
 {
+#ifdef IMPL_THRD_THRD_HOOKS
+    impl_thrd_exiting(res);
+#endif
     pthread_exit((void*)(intptr_t)res);
 }
 
@@ -326,8 +610,22 @@ static inline int
 thrd_join(thrd_t thr, int *res)
 {
     void *code;
+#ifdef EMULATED_THREADS_WAIT_STATS
+    {
+    uint64_t t0;
+    int rt;
+    // a joiner without a record would otherwise take over the joined thread's
+    impl_wait_rec_get();
+    t0 = thrd_clock_now();
+    rt = pthread_join(thr, &code);
+    impl_wait_stats_add(IMPL_WAIT_JOIN, thrd_clock_now() - t0);
+    if (rt != 0)
+        return thrd_error;
+    }
+#else
     if (pthread_join(thr, &code) != 0)
         return thrd_error;
+#endif
     if (res)
         *res = (int)(intptr_t)code;
     return thrd_success;
@@ -338,7 +636,15 @@ static inline void
 thrd_sleep(const struct timespec *time_point, struct timespec *remaining)
 {
     assert(time_point != NULL);
+#ifdef EMULATED_THREADS_WAIT_STATS
+    {
+    uint64_t t0 = thrd_clock_now();
+    nanosleep(time_point, remaining);
+    impl_wait_stats_add(IMPL_WAIT_SLEEP, thrd_clock_now() - t0);
+    }
+#else
     nanosleep(time_point, remaining);
+#endif
 }
 
 // 7.25.5.8
@@ -355,13 +661,17 @@ static inline int
 tss_create(tss_t *key, tss_dtor_t dtor)
 {
     assert(key != NULL);
-    return (pthread_key_create(key, dtor) == 0) ? thrd_success : thrd_error;
+    if (pthread_key_create(key, dtor) != 0)
+        return thrd_error;
+    IMPL_THRD_PROBE2(tss_create, *key, dtor);
+    return thrd_success;
 }
 
 // 7.25.6.2
 static inline void
 tss_delete(tss_t key)
 {
+    IMPL_THRD_PROBE1(tss_delete, key);
     pthread_key_delete(key);
 }
 
@@ -369,6 +679,7 @@ tss_delete(tss_t key)
 static inline void *
 tss_get(tss_t key)
 {
+    IMPL_THRD_PROBE1(tss_get, key);
     return pthread_getspecific(key);
 }
 
@@ -376,21 +687,1747 @@ tss_get(tss_t key)
 static inline int
 tss_set(tss_t key, void *val)
 {
+    IMPL_THRD_PROBE2(tss_set, key, val);
     return (pthread_setspecific(key, val) == 0) ? thrd_success : thrd_error;
 }
 
+#endif  // IMPL_THRD_NATIVE
+
 
 /*-------------------- 7.25.7 Time functions --------------------*/
+static inline int
+impl_timespec_base2clock(int base, clockid_t *clk)
+{
+    switch (base) {
+    case TIME_UTC:           *clk = CLOCK_REALTIME; return 1;
+    case TIME_MONOTONIC:     *clk = CLOCK_MONOTONIC; return 1;
+    case TIME_ACTIVE:        *clk = CLOCK_PROCESS_CPUTIME_ID; return 1;
+    case TIME_THREAD_ACTIVE: *clk = CLOCK_THREAD_CPUTIME_ID; return 1;
+    }
+    return 0;
+}
+
 // 7.25.6.1
 #ifndef HAVE_TIMESPEC_GET
 static inline int
 timespec_get(struct timespec *ts, int base)
 {
+    clockid_t clk;
     if (!ts) return 0;
-    if (base == TIME_UTC) {
-        clock_gettime(CLOCK_REALTIME, ts);
-        return base;
+    if (!impl_timespec_base2clock(base, &clk))
+        return 0;
+    if (clock_gettime(clk, ts) != 0)
+        return 0;
+    return base;
+}
+#endif
+
+// declared by <time.h> in C2X mode since glibc 2.34
+#if !defined(HAVE_TIMESPEC_GETRES) && defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 34) && (__GLIBC_USE(ISOC2X) || __GLIBC_USE(ISOC23))
+#define HAVE_TIMESPEC_GETRES
+#endif
+#endif
+
+#ifndef HAVE_TIMESPEC_GETRES
+static inline int
+timespec_getres(struct timespec *res, int base)
+{
+    clockid_t clk;
+    struct timespec dummy;
+    if (!impl_timespec_base2clock(base, &clk))
+        return 0;
+    if (clock_getres(clk, res ? res : &dummy) != 0)
+        return 0;
+    return base;
+}
+#endif
+
+
+/*------------------- Non-standard extensions -------------------*/
+#if !defined(EMULATED_THREADS_NO_CYCLE_CLOCK) && defined(__GNUC__) \
+    && (defined(__x86_64__) || defined(__aarch64__))
+#define IMPL_THRD_HAVE_CYCLE_CLOCK
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#endif
+
+static inline void
+impl_thrd_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+struct impl_thrd_clock {
+    unsigned seq;  // odd while base_* and mult change
+    int reanchoring;
+    uint64_t base_cycles;
+    uint64_t base_ns;
+    uint64_t mult;  // ns per cycle, 32.32 fixed point
+    uint64_t cal_cycles;  // first sample, for the long-term rate
+    uint64_t cal_ns;
+    uint64_t reanchor_cycles;
+    int calibrating;  // cal_* taken, mult not yet known
+    int use_cycles;
+    int ready;
+};
+
+// how often the cycle counter is re-synchronised with CLOCK_MONOTONIC
+#define IMPL_THRD_CLOCK_REANCHOR_NS 1000000000u
+// how long the first calibration measures the counter's rate
+#define IMPL_THRD_CLOCK_CALIBRATE_NS 10000000u
+
+IMPL_THRD_GLOBAL struct impl_thrd_clock impl_thrd_clock_state;
+IMPL_THRD_GLOBAL once_flag impl_thrd_clock_once = ONCE_FLAG_INIT;
+IMPL_THRD_GLOBAL __thread uint64_t impl_thrd_clock_last;  // per-thread floor
+
+static inline uint64_t
+impl_thrd_clock_monotonic(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+#ifdef IMPL_THRD_HAVE_CYCLE_CLOCK
+static inline uint64_t
+impl_thrd_clock_cycles(void)
+{
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    uint64_t v;
+    __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(v) :: "memory");
+    return v;
+#endif
+}
+
+static inline int
+impl_thrd_clock_invariant(void)
+{
+#if defined(__x86_64__)
+    unsigned eax, ebx, ecx, edx;
+    // CPUID.80000007H:EDX[8] is the invariant TSC flag
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return (edx & (1u << 8)) != 0;
+#else
+    // the architected generic timer always ticks at a constant rate
+    return 1;
+#endif
+}
+
+/* Reads the cycle counter and CLOCK_MONOTONIC as close together as possible. */
+static inline void
+impl_thrd_clock_sample(uint64_t *cycles, uint64_t *ns)
+{
+    uint64_t best = UINT64_MAX;
+    int i;
+    for (i = 0; i < 5; i++) {
+        uint64_t c0 = impl_thrd_clock_cycles();
+        uint64_t t = impl_thrd_clock_monotonic();
+        uint64_t c1 = impl_thrd_clock_cycles();
+        // a preemption between the reads shows up as a wide bracket
+        if (i == 0 || (c1 >= c0 && c1 - c0 < best)) {
+            best = c1 - c0;
+            *cycles = c0 + (c1 - c0) / 2;
+            *ns = t;
+        }
     }
-    return 0;
 }
+
+/*
+ * Re-synchronises with CLOCK_MONOTONIC without stepping back: the rate
+ * is set so that the error left is gone one period from now.
+ */
+static void
+impl_thrd_clock_reanchor(struct impl_thrd_clock *c)
+{
+    const uint64_t period = IMPL_THRD_CLOCK_REANCHOR_NS;
+    uint64_t cyc, t, now, target, rate, mult;
+    unsigned seq;
+
+    if (__atomic_exchange_n(&c->reanchoring, 1, __ATOMIC_ACQUIRE))
+        return;  // another thread is at it
+    // only this thread writes the fields, so they can be read directly
+    if (impl_thrd_clock_cycles() - c->base_cycles <= c->reanchor_cycles) {
+        __atomic_store_n(&c->reanchoring, 0, __ATOMIC_RELEASE);
+        return;  // done meanwhile
+    }
+    impl_thrd_clock_sample(&cyc, &t);
+    now = c->base_ns + (uint64_t)(((unsigned __int128)(cyc - c->base_cycles) * c->mult) >> 32);
+    if (t > now + period)
+        now = t;  // far behind, e.g. after a suspend: step forward
+    target = t + period;
+    if (target < now + period / 2)
+        target = now + period / 2;  // far ahead: run at half speed at most
+    rate = (uint64_t)(((unsigned __int128)(t - c->cal_ns) << 32) / (cyc - c->cal_cycles));
+    mult = (uint64_t)((unsigned __int128)rate * (target - now) / period);
+
+    seq = c->seq;
+    __atomic_store_n(&c->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&c->mult, mult, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->base_cycles, cyc, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->base_ns, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&c->reanchoring, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Switches to the cycle counter once the first sample is at least
+ * IMPL_THRD_CLOCK_CALIBRATE_NS old. Both clocks agree at the switch.
+ */
+static void
+impl_thrd_clock_calibrate_end(struct impl_thrd_clock *c)
+{
+    uint64_t c1, t1;
+
+    if (__atomic_exchange_n(&c->reanchoring, 1, __ATOMIC_ACQUIRE))
+        return;  // another thread is at it
+    if (!__atomic_load_n(&c->calibrating, __ATOMIC_RELAXED))
+        goto out;  // done meanwhile
+    impl_thrd_clock_sample(&c1, &t1);
+    if (t1 - c->cal_ns < IMPL_THRD_CLOCK_CALIBRATE_NS)
+        goto out;
+    if (c1 > c->cal_cycles) {
+        c->mult = ((t1 - c->cal_ns) << 32) / (c1 - c->cal_cycles);
+        if (c->mult != 0) {
+            c->base_cycles = c1;
+            c->base_ns = t1;
+            c->reanchor_cycles = ((uint64_t)IMPL_THRD_CLOCK_REANCHOR_NS << 32) / c->mult;
+            __atomic_store_n(&c->use_cycles, 1, __ATOMIC_RELEASE);
+        }
+    }
+    __atomic_store_n(&c->calibrating, 0, __ATOMIC_RELEASE);
+out:
+    __atomic_store_n(&c->reanchoring, 0, __ATOMIC_RELEASE);
+}
+#endif
+
+/* takes the first calibration sample; never blocks */
+static void
+impl_thrd_clock_calibrate_begin(void)
+{
+#ifdef IMPL_THRD_HAVE_CYCLE_CLOCK
+    struct impl_thrd_clock *c = &impl_thrd_clock_state;
+    if (impl_thrd_clock_invariant()) {
+        impl_thrd_clock_sample(&c->cal_cycles, &c->cal_ns);
+        c->calibrating = 1;
+    }
+#endif
+    __atomic_store_n(&impl_thrd_clock_state.ready, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Nanoseconds on the CLOCK_MONOTONIC time line, read from the CPU cycle
+ * counter when it is invariant. The counter's rate is measured over the
+ * first IMPL_THRD_CLOCK_CALIBRATE_NS after the first call, during which
+ * CLOCK_MONOTONIC is read instead; it is then re-synchronised with
+ * CLOCK_MONOTONIC about once a second by slewing its rate, so the two
+ * stay within a few microseconds. The value never goes back within a
+ * thread; values read in different threads may be out of order by the
+ * slewing error.
+ */
+static inline uint64_t
+thrd_clock_now(void)
+{
+    uint64_t now;
+    if (!__atomic_load_n(&impl_thrd_clock_state.ready, __ATOMIC_ACQUIRE))
+        call_once(&impl_thrd_clock_once, impl_thrd_clock_calibrate_begin);
+#ifdef IMPL_THRD_HAVE_CYCLE_CLOCK
+    if (__atomic_load_n(&impl_thrd_clock_state.use_cycles, __ATOMIC_ACQUIRE)) {
+        struct impl_thrd_clock *c = &impl_thrd_clock_state;
+        uint64_t base_cycles, base_ns, mult, delta;
+        unsigned seq;
+        for (;;) {
+            seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+            base_cycles = __atomic_load_n(&c->base_cycles, __ATOMIC_RELAXED);
+            base_ns = __atomic_load_n(&c->base_ns, __ATOMIC_RELAXED);
+            mult = __atomic_load_n(&c->mult, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (!(seq & 1) && __atomic_load_n(&c->seq, __ATOMIC_RELAXED) == seq)
+                break;
+            impl_thrd_cpu_relax();
+        }
+        delta = impl_thrd_clock_cycles() - base_cycles;
+        if (__builtin_expect(delta > c->reanchor_cycles, 0))
+            impl_thrd_clock_reanchor(c);
+        now = base_ns + (uint64_t)(((unsigned __int128)delta * mult) >> 32);
+        // a reader racing a re-anchor may have seen a faster rate
+        if (__builtin_expect(now < impl_thrd_clock_last, 0))
+            return impl_thrd_clock_last;
+        impl_thrd_clock_last = now;
+        return now;
+    }
+#endif
+    now = impl_thrd_clock_monotonic();
+#ifdef IMPL_THRD_HAVE_CYCLE_CLOCK
+    if (__builtin_expect(__atomic_load_n(&impl_thrd_clock_state.calibrating, __ATOMIC_RELAXED), 0)
+      && now - impl_thrd_clock_state.cal_ns >= IMPL_THRD_CLOCK_CALIBRATE_NS)
+        impl_thrd_clock_calibrate_end(&impl_thrd_clock_state);
+#endif
+    impl_thrd_clock_last = now;
+    return now;
+}
+
+/*
+ * Completes the calibration of thrd_clock_now(), waiting for up to
+ * IMPL_THRD_CLOCK_CALIBRATE_NS, so that a measurement started afterwards
+ * reads the cycle counter throughout.
+ */
+static inline void
+thrd_clock_calibrate(void)
+{
+    thrd_clock_now();
+#ifdef IMPL_THRD_HAVE_CYCLE_CLOCK
+    while (__atomic_load_n(&impl_thrd_clock_state.calibrating, __ATOMIC_ACQUIRE)) {
+        uint64_t left = IMPL_THRD_CLOCK_CALIBRATE_NS
+            - (impl_thrd_clock_monotonic() - impl_thrd_clock_state.cal_ns);
+        struct timespec delay;
+        delay.tv_sec = 0;
+        delay.tv_nsec = left < IMPL_THRD_CLOCK_CALIBRATE_NS ? (long)left : 0;
+        nanosleep(&delay, NULL);
+        thrd_clock_now();
+    }
+#endif
+}
+
+
+static inline void
+impl_timespec_add_ns(struct timespec *ts, uint64_t ns)
+{
+    ns += (uint64_t)ts->tv_nsec;
+    ts->tv_sec += (time_t)(ns / 1000000000u);
+    ts->tv_nsec = (long)(ns % 1000000000u);
+}
+
+static inline int64_t
+impl_timespec_diff_ns(const struct timespec *a, const struct timespec *b)
+{
+    return (int64_t)(a->tv_sec - b->tv_sec) * 1000000000
+        + (a->tv_nsec - b->tv_nsec);
+}
+
+/*
+ * Sleep until the absolute time `abs_time' of time base `base'
+ * (TIME_UTC or TIME_MONOTONIC). Returns 0 when the deadline has been
+ * reached, -1 if interrupted by a signal, or another negative value on
+ * failure, like thrd_sleep() in C11.
+ */
+static inline int
+thrd_sleep_until(const struct timespec *abs_time, int base)
+{
+    clockid_t clk;
+    int rt;
+
+    assert(abs_time != NULL);
+    if (base != TIME_UTC && base != TIME_MONOTONIC)
+        return -2;
+    impl_timespec_base2clock(base, &clk);
+#ifdef EMULATED_THREADS_WAIT_STATS
+    {
+    uint64_t t0 = thrd_clock_now();
+    rt = clock_nanosleep(clk, TIMER_ABSTIME, abs_time, NULL);
+    impl_wait_stats_add(IMPL_WAIT_SLEEP, thrd_clock_now() - t0);
+    }
+#else
+    rt = clock_nanosleep(clk, TIMER_ABSTIME, abs_time, NULL);
+#endif
+    if (rt == 0)
+        return 0;
+    return (rt == EINTR) ? -1 : -2;
+}
+
+/*
+ * Periodic wake-ups on absolute deadlines, so the time spent between
+ * waits does not accumulate as drift.
+ */
+typedef struct {
+    struct timespec next;      // next deadline
+    uint64_t period_ns;
+    int base;
+    unsigned long overruns;    // total number of missed periods
+} thrd_ticker_t;
+
+static inline int
+thrd_ticker_init(thrd_ticker_t *tk, const struct timespec *period, int base)
+{
+    assert(tk != NULL);
+    assert(period != NULL);
+    if (base != TIME_UTC && base != TIME_MONOTONIC)
+        return thrd_error;
+    if (period->tv_sec < 0 || period->tv_nsec < 0
+      || (period->tv_sec == 0 && period->tv_nsec == 0))
+        return thrd_error;
+    tk->period_ns = (uint64_t)period->tv_sec * 1000000000u + (uint64_t)period->tv_nsec;
+    tk->base = base;
+    tk->overruns = 0;
+    if (timespec_get(&tk->next, base) != base)
+        return thrd_error;
+    impl_timespec_add_ns(&tk->next, tk->period_ns);
+    return thrd_success;
+}
+
+/*
+ * Wait for the next deadline. Returns the number of periods missed since
+ * the previous call (0 when on schedule), or -1 on failure. Deadlines a
+ * whole period or more in the past are skipped rather than replayed back
+ * to back; a call less than a period late returns at once.
+ */
+static inline long
+thrd_ticker_wait(thrd_ticker_t *tk)
+{
+    struct timespec now;
+    int64_t late;
+    long missed = 0;
+    int rt;
+
+    assert(tk != NULL);
+    if (timespec_get(&now, tk->base) != tk->base)
+        return -1;
+    late = impl_timespec_diff_ns(&now, &tk->next);
+    if (late > 0 && (uint64_t)late >= tk->period_ns) {
+        // a whole period or more behind; skip to the latest deadline passed
+        missed = (long)((uint64_t)late / tk->period_ns);
+        impl_timespec_add_ns(&tk->next, (uint64_t)missed * tk->period_ns);
+        tk->overruns += (unsigned long)missed;
+    }
+    while ((rt = thrd_sleep_until(&tk->next, tk->base)) == -1)
+        ;
+    if (rt != 0)
+        return -1;
+    impl_timespec_add_ns(&tk->next, tk->period_ns);
+    return missed;
+}
+
+
+/*
+ * Set the timer slack of the calling thread, i.e. how late the kernel
+ * may fire its timers to coalesce wake-ups. Linux only.
+ */
+static inline int
+thrd_set_timerslack(unsigned long ns)
+{
+#if defined(__linux__) && defined(PR_SET_TIMERSLACK)
+    return (prctl(PR_SET_TIMERSLACK, ns, 0, 0, 0) == 0) ? thrd_success : thrd_error;
+#else
+    (void)ns;
+    return thrd_error;
 #endif
+}
+
+#ifndef EMULATED_THREADS_SPIN_SLEEP_NS
+#define EMULATED_THREADS_SPIN_SLEEP_NS 30000
+#endif
+
+/*
+ * Like thrd_sleep(), but trades CPU time for accuracy: the first part of
+ * the interval is slept with minimal timer slack and the last
+ * EMULATED_THREADS_SPIN_SLEEP_NS are busy-waited on the monotonic clock.
+ * The thread's timer slack is restored afterwards. Not interrupted by
+ * signals.
+ */
+static inline void
+thrd_sleep_precise(const struct timespec *duration)
+{
+    uint64_t now, deadline;
+
+    assert(duration != NULL);
+    // CLOCK_MONOTONIC itself, so that sleeping and spinning agree on the deadline
+    now = impl_thrd_clock_monotonic();
+    deadline = now + (uint64_t)duration->tv_sec * 1000000000u
+        + (uint64_t)duration->tv_nsec;
+    if (deadline - now > EMULATED_THREADS_SPIN_SLEEP_NS) {
+        struct timespec wake;
+        uint64_t ns = deadline - EMULATED_THREADS_SPIN_SLEEP_NS;
+#if defined(__linux__) && defined(PR_GET_TIMERSLACK)
+        int slack = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+        if (slack > 1)
+            thrd_set_timerslack(1);
+#endif
+        wake.tv_sec = (time_t)(ns / 1000000000u);
+        wake.tv_nsec = (long)(ns % 1000000000u);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR)
+            ;
+#if defined(__linux__) && defined(PR_GET_TIMERSLACK)
+        if (slack > 1)
+            thrd_set_timerslack((unsigned long)slack);
+#endif
+    }
+    while (impl_thrd_clock_monotonic() < deadline)
+        impl_thrd_cpu_relax();
+}
+
+
+/*------------------------ Lock profiling ------------------------*/
+/*
+Implementation limits:
+  - IMPL_MTX_NAMES named mutexes per process.
+  - IMPL_MTX_PROF_SLOTS distinct contended mutexes per thread; further
+    ones are only counted as dropped.
+  - Per-thread buffers are recycled, not freed, when a thread exits, so
+    its records remain visible to thrd_profile_dump().
+*/
+#ifdef IMPL_THRD_MTX_NAMES
+#define IMPL_MTX_NAMES 1024
+
+struct impl_mtx_name {
+    const void *mtx;
+    const char *name;
+};
+
+IMPL_THRD_GLOBAL struct impl_mtx_name impl_mtx_names[IMPL_MTX_NAMES];
+IMPL_THRD_GLOBAL int impl_mtx_names_used;  // set once any mutex is named
+
+static inline size_t
+impl_mtx_hash(const void *mtx)
+{
+    return (size_t)(((uintptr_t)mtx >> 3) * 0x9E3779B97F4A7C15ull);
+}
+
+/*
+ * Give `mtx' a name for the lock statistics. `name' is not copied and
+ * must outlive the mutex. A no-op unless a lock instrumentation mode is
+ * enabled.
+ */
+static inline void
+mtx_set_name(mtx_t *mtx, const char *name)
+{
+    size_t i, h = impl_mtx_hash(mtx);
+    if (name != NULL && !__atomic_load_n(&impl_mtx_names_used, __ATOMIC_RELAXED))
+        __atomic_store_n(&impl_mtx_names_used, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < IMPL_MTX_NAMES; i++) {
+        struct impl_mtx_name *e = &impl_mtx_names[(h + i) % IMPL_MTX_NAMES];
+        const void *key = __atomic_load_n(&e->mtx, __ATOMIC_ACQUIRE);
+        if (key == NULL) {
+            if (name == NULL)
+                return;
+            if (!__atomic_compare_exchange_n(&e->mtx, &key, (const void *)mtx, 0,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+              && key != mtx)
+                continue;
+        } else if (key != mtx) {
+            continue;
+        }
+        // slots are never released; a destroyed mutex just loses its name
+        __atomic_store_n(&e->name, name, __ATOMIC_RELEASE);
+        return;
+    }
+}
+
+/* Called by mtx_destroy(); skips the table scan while no mutex has a name. */
+static inline void
+impl_mtx_drop_name(mtx_t *mtx)
+{
+    if (__atomic_load_n(&impl_mtx_names_used, __ATOMIC_RELAXED))
+        mtx_set_name(mtx, NULL);
+}
+
+static inline const char *
+impl_mtx_get_name(const void *mtx)
+{
+    size_t i, h = impl_mtx_hash(mtx);
+    for (i = 0; i < IMPL_MTX_NAMES; i++) {
+        struct impl_mtx_name *e = &impl_mtx_names[(h + i) % IMPL_MTX_NAMES];
+        const void *key = __atomic_load_n(&e->mtx, __ATOMIC_ACQUIRE);
+        if (key == NULL)
+            return NULL;
+        if (key == mtx)
+            return __atomic_load_n(&e->name, __ATOMIC_ACQUIRE);
+    }
+    return NULL;
+}
+#else
+static inline void
+mtx_set_name(mtx_t *mtx, const char *name)
+{
+    (void)mtx; (void)name;
+}
+#endif  // IMPL_THRD_MTX_NAMES
+
+#ifdef EMULATED_THREADS_PROFILE_LOCKS
+#define IMPL_MTX_PROF_SLOTS 256
+
+struct impl_mtx_prof_rec {
+    const void *mtx;
+    uint64_t waits;
+    uint64_t wait_ns;
+    uint64_t max_wait_ns;
+    uint64_t try_fails;
+};
+
+struct impl_mtx_prof_buf {
+    struct impl_mtx_prof_buf *next;
+    int in_use;
+    uint64_t dropped;
+    struct impl_mtx_prof_rec recs[IMPL_MTX_PROF_SLOTS];
+};
+
+IMPL_THRD_GLOBAL struct impl_mtx_prof_buf *impl_mtx_prof_bufs;
+IMPL_THRD_GLOBAL __thread struct impl_mtx_prof_buf *impl_mtx_prof_tls;
+IMPL_THRD_GLOBAL pthread_key_t impl_mtx_prof_key;
+IMPL_THRD_GLOBAL once_flag impl_mtx_prof_once = ONCE_FLAG_INIT;
+
+static void
+impl_mtx_prof_release(void *p)
+{
+    struct impl_mtx_prof_buf *buf = (struct impl_mtx_prof_buf *)p;
+    __atomic_store_n(&buf->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void
+impl_mtx_prof_init(void)
+{
+    pthread_key_create(&impl_mtx_prof_key, impl_mtx_prof_release);
+}
+
+static inline struct impl_mtx_prof_buf *
+impl_mtx_prof_buf_get(void)
+{
+    struct impl_mtx_prof_buf *buf = impl_mtx_prof_tls;
+    if (buf)
+        return buf;
+
+    call_once(&impl_mtx_prof_once, impl_mtx_prof_init);
+    // adopt the buffer of an exited thread before allocating a new one
+    for (buf = __atomic_load_n(&impl_mtx_prof_bufs, __ATOMIC_ACQUIRE); buf; buf = buf->next) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&buf->in_use, &expected, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (!buf) {
+        buf = (struct impl_mtx_prof_buf *)calloc(1, sizeof(*buf));
+        if (!buf)
+            return NULL;
+        buf->in_use = 1;
+        buf->next = __atomic_load_n(&impl_mtx_prof_bufs, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&impl_mtx_prof_bufs, &buf->next, buf, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    pthread_setspecific(impl_mtx_prof_key, buf);
+    impl_mtx_prof_tls = buf;
+    return buf;
+}
+
+/*
+ * Only the owning thread writes to its buffer, so updates are plain
+ * read-modify-write sequences published with relaxed stores.
+ */
+static inline struct impl_mtx_prof_rec *
+impl_mtx_prof_rec_get(const void *mtx)
+{
+    struct impl_mtx_prof_buf *buf = impl_mtx_prof_buf_get();
+    size_t i, h = impl_mtx_hash(mtx);
+
+    if (!buf)
+        return NULL;
+    for (i = 0; i < IMPL_MTX_PROF_SLOTS; i++) {
+        struct impl_mtx_prof_rec *r = &buf->recs[(h + i) % IMPL_MTX_PROF_SLOTS];
+        if (r->mtx == mtx)
+            return r;
+        if (r->mtx == NULL) {
+            __atomic_store_n(&r->mtx, mtx, __ATOMIC_RELEASE);
+            return r;
+        }
+    }
+    __atomic_store_n(&buf->dropped, buf->dropped + 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+#define IMPL_MTX_PROF_ADD(field, v) \
+    __atomic_store_n(&(field), (field) + (v), __ATOMIC_RELAXED)
+
+static inline void
+impl_mtx_prof_contended(mtx_t *mtx, uint64_t ns)
+{
+    struct impl_mtx_prof_rec *r = impl_mtx_prof_rec_get(mtx);
+    if (r) {
+        IMPL_MTX_PROF_ADD(r->waits, 1);
+        IMPL_MTX_PROF_ADD(r->wait_ns, ns);
+        if (ns > r->max_wait_ns)
+            __atomic_store_n(&r->max_wait_ns, ns, __ATOMIC_RELAXED);
+    }
+}
+
+static inline void
+impl_mtx_prof_trylock_failed(mtx_t *mtx)
+{
+    struct impl_mtx_prof_rec *r = impl_mtx_prof_rec_get(mtx);
+    if (r)
+        IMPL_MTX_PROF_ADD(r->try_fails, 1);
+}
+
+static int
+impl_mtx_prof_cmp_mtx(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)((const struct impl_mtx_prof_rec *)a)->mtx;
+    uintptr_t y = (uintptr_t)((const struct impl_mtx_prof_rec *)b)->mtx;
+    return (x > y) - (x < y);
+}
+
+static int
+impl_mtx_prof_cmp_wait(const void *a, const void *b)
+{
+    uint64_t x = ((const struct impl_mtx_prof_rec *)a)->wait_ns;
+    uint64_t y = ((const struct impl_mtx_prof_rec *)b)->wait_ns;
+    return (x < y) - (x > y);
+}
+
+/*
+ * Print the lock contention statistics of all threads, merged per mutex
+ * and sorted by total wait time. Returns thrd_nomem if the snapshot
+ * cannot be allocated, thrd_success otherwise.
+ */
+static inline int
+thrd_profile_dump(FILE *out)
+{
+    struct impl_mtx_prof_buf *head, *buf;
+    struct impl_mtx_prof_rec *all;
+    size_t i, n = 0, m = 0, nbufs = 0;
+    uint64_t dropped = 0;
+
+    assert(out != NULL);
+    // buffers are only pushed at the head, so the list from here on stays the same
+    head = __atomic_load_n(&impl_mtx_prof_bufs, __ATOMIC_ACQUIRE);
+    for (buf = head; buf; buf = buf->next)
+        nbufs++;
+    all = (struct impl_mtx_prof_rec *)malloc((nbufs ? nbufs : 1) * IMPL_MTX_PROF_SLOTS * sizeof(*all));
+    if (!all)
+        return thrd_nomem;
+
+    for (buf = head; buf; buf = buf->next) {
+        dropped += __atomic_load_n(&buf->dropped, __ATOMIC_RELAXED);
+        for (i = 0; i < IMPL_MTX_PROF_SLOTS; i++) {
+            const struct impl_mtx_prof_rec *r = &buf->recs[i];
+            struct impl_mtx_prof_rec *d = &all[n];
+            d->mtx = __atomic_load_n(&r->mtx, __ATOMIC_ACQUIRE);
+            if (!d->mtx)
+                continue;
+            d->waits = __atomic_load_n(&r->waits, __ATOMIC_RELAXED);
+            d->wait_ns = __atomic_load_n(&r->wait_ns, __ATOMIC_RELAXED);
+            d->max_wait_ns = __atomic_load_n(&r->max_wait_ns, __ATOMIC_RELAXED);
+            d->try_fails = __atomic_load_n(&r->try_fails, __ATOMIC_RELAXED);
+            n++;
+        }
+    }
+
+    qsort(all, n, sizeof(*all), impl_mtx_prof_cmp_mtx);
+    for (i = 0; i < n; i++) {
+        if (m > 0 && all[m - 1].mtx == all[i].mtx) {
+            struct impl_mtx_prof_rec *d = &all[m - 1];
+            d->waits += all[i].waits;
+            d->wait_ns += all[i].wait_ns;
+            d->try_fails += all[i].try_fails;
+            if (all[i].max_wait_ns > d->max_wait_ns)
+                d->max_wait_ns = all[i].max_wait_ns;
+        } else {
+            all[m++] = all[i];
+        }
+    }
+    qsort(all, m, sizeof(*all), impl_mtx_prof_cmp_wait);
+
+    fprintf(out, "%-18s %-24s %12s %16s %14s %14s %12s\n", "mutex", "name",
+            "waits", "total_wait_ns", "max_wait_ns", "avg_wait_ns", "try_fails");
+    for (i = 0; i < m; i++) {
+        const char *name = impl_mtx_get_name(all[i].mtx);
+        fprintf(out, "%-18p %-24s %12llu %16llu %14llu %14llu %12llu\n",
+                all[i].mtx, name ? name : "-",
+                (unsigned long long)all[i].waits,
+                (unsigned long long)all[i].wait_ns,
+                (unsigned long long)all[i].max_wait_ns,
+                (unsigned long long)(all[i].waits ? all[i].wait_ns / all[i].waits : 0),
+                (unsigned long long)all[i].try_fails);
+    }
+    if (dropped)
+        fprintf(out, "# %llu contended acquisitions not recorded (per-thread table full)\n",
+                (unsigned long long)dropped);
+    free(all);
+    return thrd_success;
+}
+#else
+static inline int
+thrd_profile_dump(FILE *out)
+{
+    (void)out;
+    return thrd_success;
+}
+#endif  // EMULATED_THREADS_PROFILE_LOCKS
+
+/*------------------------ Lock hold time ------------------------*/
+/*
+Implementation limits:
+  - IMPL_MTX_HOLD_DEPTH mutexes held at once per thread; deeper nesting
+    is not timed.
+  - IMPL_MTX_HOLD_SLOTS distinct mutexes per process get a histogram.
+  - A slow hold that ends in cnd_wait()/cnd_timedwait() is reported
+    to the callback when the thread next unlocks that mutex; of several
+    such holds before that unlock only the longest is reported.
+*/
+#ifdef EMULATED_THREADS_PROFILE_HOLD
+#define IMPL_MTX_HOLD_DEPTH 32
+#define IMPL_MTX_HOLD_SLOTS 256
+#define IMPL_MTX_HIST_SUB_BITS 3
+#define IMPL_MTX_HIST_SUB (1 << IMPL_MTX_HIST_SUB_BITS)
+#define IMPL_MTX_HIST_BUCKETS ((64 - IMPL_MTX_HIST_SUB_BITS + 1) * IMPL_MTX_HIST_SUB)
+
+typedef void (*mtx_hold_cb_t)(mtx_t *mtx, const char *name, uint64_t hold_ns);
+
+struct impl_mtx_hist {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[IMPL_MTX_HIST_BUCKETS];
+};
+
+struct impl_mtx_hold_slot {
+    const void *mtx;
+    struct impl_mtx_hist *hist;
+};
+
+struct impl_mtx_held {
+    mtx_t *mtx;
+    uint64_t since;
+    uint64_t pending_ns;  // longest slow hold ended by a condvar wait
+    unsigned depth;       // recursive acquisitions beyond the first
+};
+
+struct impl_mtx_hold_tls {
+    unsigned nheld;
+    struct impl_mtx_held held[IMPL_MTX_HOLD_DEPTH];
+    uint64_t released_pending_ns;  // pending_ns of the entry just released
+};
+
+/* thrd_hold_dump() sorts a snapshot, as the totals keep changing */
+struct impl_mtx_hold_snap {
+    const void *mtx;
+    const struct impl_mtx_hist *hist;
+    uint64_t total_ns;
+};
+
+IMPL_THRD_GLOBAL struct impl_mtx_hold_slot impl_mtx_hold_slots[IMPL_MTX_HOLD_SLOTS];
+IMPL_THRD_GLOBAL __thread struct impl_mtx_hold_tls impl_mtx_hold_tls;
+IMPL_THRD_GLOBAL mtx_hold_cb_t impl_mtx_hold_cb;
+IMPL_THRD_GLOBAL uint64_t impl_mtx_hold_threshold_ns;
+
+/*
+ * Call `cb' after every unlock of a mutex that was held for longer than
+ * `threshold_us'. The callback runs once the mutex has been released.
+ * Pass NULL to remove it.
+ */
+static inline void
+mtx_set_hold_callback(mtx_hold_cb_t cb, unsigned long threshold_us)
+{
+    __atomic_store_n(&impl_mtx_hold_threshold_ns, (uint64_t)threshold_us * 1000u, __ATOMIC_RELAXED);
+    __atomic_store_n(&impl_mtx_hold_cb, cb, __ATOMIC_RELEASE);
+}
+
+static inline unsigned
+impl_mtx_hist_bucket(uint64_t v)
+{
+    unsigned e;
+    if (v < IMPL_MTX_HIST_SUB)
+        return (unsigned)v;
+    e = 63 - (unsigned)__builtin_clzll(v);
+    return (e - IMPL_MTX_HIST_SUB_BITS + 1) * IMPL_MTX_HIST_SUB
+        + (unsigned)((v >> (e - IMPL_MTX_HIST_SUB_BITS)) & (IMPL_MTX_HIST_SUB - 1));
+}
+
+/* highest value that maps to bucket `b' */
+static inline uint64_t
+impl_mtx_hist_value(unsigned b)
+{
+    unsigned e, sub;
+    if (b < IMPL_MTX_HIST_SUB)
+        return b;
+    e = b / IMPL_MTX_HIST_SUB + IMPL_MTX_HIST_SUB_BITS - 1;
+    sub = b % IMPL_MTX_HIST_SUB;
+    return (((uint64_t)(IMPL_MTX_HIST_SUB + sub + 1)) << (e - IMPL_MTX_HIST_SUB_BITS)) - 1;
+}
+
+static inline struct impl_mtx_hist *
+impl_mtx_hist_get(const void *mtx)
+{
+    size_t i, h = impl_mtx_hash(mtx);
+    for (i = 0; i < IMPL_MTX_HOLD_SLOTS; i++) {
+        struct impl_mtx_hold_slot *e = &impl_mtx_hold_slots[(h + i) % IMPL_MTX_HOLD_SLOTS];
+        const void *key = __atomic_load_n(&e->mtx, __ATOMIC_ACQUIRE);
+        struct impl_mtx_hist *hist, *expected = NULL;
+        if (key == NULL) {
+            if (!__atomic_compare_exchange_n(&e->mtx, &key, mtx, 0,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+              && key != mtx)
+                continue;
+        } else if (key != mtx) {
+            continue;
+        }
+        hist = __atomic_load_n(&e->hist, __ATOMIC_ACQUIRE);
+        if (hist)
+            return hist;
+        hist = (struct impl_mtx_hist *)calloc(1, sizeof(*hist));
+        if (!hist)
+            return NULL;
+        if (!__atomic_compare_exchange_n(&e->hist, &expected, hist, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(hist);
+            hist = expected;
+        }
+        return hist;
+    }
+    return NULL;
+}
+
+static inline void
+impl_mtx_hold_acquired(mtx_t *mtx)
+{
+    struct impl_mtx_hold_tls *t = &impl_mtx_hold_tls;
+    unsigned i;
+    for (i = t->nheld; i-- > 0; ) {
+        if (t->held[i].mtx == mtx) {
+            t->held[i].depth++;
+            return;
+        }
+    }
+    if (t->nheld == IMPL_MTX_HOLD_DEPTH)
+        return;
+    t->held[t->nheld].mtx = mtx;
+    t->held[t->nheld].pending_ns = 0;
+    t->held[t->nheld].depth = 0;
+    t->held[t->nheld].since = thrd_clock_now();
+    t->nheld++;
+}
+
+/* Returns the hold time if this releases the outermost acquisition, else 0. */
+static inline uint64_t
+impl_mtx_hold_release_begin(mtx_t *mtx)
+{
+    struct impl_mtx_hold_tls *t = &impl_mtx_hold_tls;
+    unsigned i;
+    t->released_pending_ns = 0;
+    for (i = t->nheld; i-- > 0; ) {
+        if (t->held[i].mtx == mtx) {
+            uint64_t since = t->held[i].since;
+            if (t->held[i].depth > 0) {
+                t->held[i].depth--;
+                return 0;
+            }
+            t->released_pending_ns = t->held[i].pending_ns;
+            // locks need not be released in LIFO order
+            memmove(&t->held[i], &t->held[i + 1], (t->nheld - i - 1) * sizeof(t->held[0]));
+            t->nheld--;
+            return thrd_clock_now() - since;
+        }
+    }
+    return 0;
+}
+
+/*
+ * A condvar wait releases and reacquires mtx with the caller still
+ * inside its critical section, so a slow hold it ends is kept with the
+ * reacquired entry and reported on the real unlock.
+ */
+static inline void
+impl_mtx_hold_release_end(mtx_t *mtx, uint64_t ns, int relocked)
+{
+    struct impl_mtx_hold_tls *t = &impl_mtx_hold_tls;
+    uint64_t threshold = __atomic_load_n(&impl_mtx_hold_threshold_ns, __ATOMIC_RELAXED);
+    uint64_t pending = t->released_pending_ns;
+    mtx_hold_cb_t cb = __atomic_load_n(&impl_mtx_hold_cb, __ATOMIC_ACQUIRE);
+
+    if (ns) {
+        struct impl_mtx_hist *hist = impl_mtx_hist_get(mtx);
+        if (hist) {
+            uint64_t max = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&hist->total_ns, ns, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&hist->buckets[impl_mtx_hist_bucket(ns)], 1, __ATOMIC_RELAXED);
+            while (ns > max && !__atomic_compare_exchange_n(&hist->max_ns, &max, ns, 1,
+                                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                ;
+        }
+    }
+    t->released_pending_ns = 0;
+    if (relocked) {
+        unsigned i;
+        if (ns > threshold && ns > pending)
+            pending = ns;
+        for (i = t->nheld; pending && i-- > 0; ) {
+            if (t->held[i].mtx == mtx) {
+                t->held[i].pending_ns = pending;
+                break;
+            }
+        }
+        return;
+    }
+    if (!cb)
+        return;
+    if (pending)
+        cb(mtx, impl_mtx_get_name(mtx), pending);
+    if (ns > threshold)
+        cb(mtx, impl_mtx_get_name(mtx), ns);
+}
+
+static int
+impl_mtx_hold_cmp(const void *a, const void *b)
+{
+    const struct impl_mtx_hold_snap *x = (const struct impl_mtx_hold_snap *)a;
+    const struct impl_mtx_hold_snap *y = (const struct impl_mtx_hold_snap *)b;
+    // slots without a histogram last
+    if (!x->hist || !y->hist)
+        return (x->hist == NULL) - (y->hist == NULL);
+    return (x->total_ns < y->total_ns) - (x->total_ns > y->total_ns);
+}
+
+static inline uint64_t
+impl_mtx_hist_percentile(const uint64_t *buckets, uint64_t count, double q)
+{
+    uint64_t rank = (uint64_t)(q * (double)count + 0.5), seen = 0;
+    unsigned b;
+    if (rank == 0)
+        rank = 1;
+    for (b = 0; b < IMPL_MTX_HIST_BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen >= rank)
+            return impl_mtx_hist_value(b);
+    }
+    return impl_mtx_hist_value(IMPL_MTX_HIST_BUCKETS - 1);
+}
+
+/*
+ * Print the hold time distribution of every mutex, sorted by total hold
+ * time. Percentiles are accurate to 1/IMPL_MTX_HIST_SUB of their value.
+ */
+static inline int
+thrd_hold_dump(FILE *out)
+{
+    struct impl_mtx_hold_snap snap[IMPL_MTX_HOLD_SLOTS];
+    uint64_t buckets[IMPL_MTX_HIST_BUCKETS];
+    size_t i;
+
+    assert(out != NULL);
+    for (i = 0; i < IMPL_MTX_HOLD_SLOTS; i++) {
+        snap[i].mtx = __atomic_load_n(&impl_mtx_hold_slots[i].mtx, __ATOMIC_ACQUIRE);
+        snap[i].hist = __atomic_load_n(&impl_mtx_hold_slots[i].hist, __ATOMIC_ACQUIRE);
+        snap[i].total_ns = snap[i].hist
+            ? __atomic_load_n(&snap[i].hist->total_ns, __ATOMIC_RELAXED) : 0;
+    }
+    qsort(snap, IMPL_MTX_HOLD_SLOTS, sizeof(snap[0]), impl_mtx_hold_cmp);
+
+    fprintf(out, "%-18s %-24s %12s %16s %12s %12s %12s %12s\n", "mutex", "name",
+            "holds", "total_hold_ns", "p50_ns", "p99_ns", "p999_ns", "max_ns");
+    for (i = 0; i < IMPL_MTX_HOLD_SLOTS && snap[i].hist; i++) {
+        const struct impl_mtx_hist *hist = snap[i].hist;
+        const char *name = impl_mtx_get_name(snap[i].mtx);
+        uint64_t count = 0;
+        unsigned b;
+        for (b = 0; b < IMPL_MTX_HIST_BUCKETS; b++) {
+            buckets[b] = __atomic_load_n(&hist->buckets[b], __ATOMIC_RELAXED);
+            count += buckets[b];
+        }
+        if (!count)
+            continue;
+        fprintf(out, "%-18p %-24s %12llu %16llu %12llu %12llu %12llu %12llu\n",
+                snap[i].mtx, name ? name : "-",
+                (unsigned long long)count,
+                (unsigned long long)snap[i].total_ns,
+                (unsigned long long)impl_mtx_hist_percentile(buckets, count, 0.50),
+                (unsigned long long)impl_mtx_hist_percentile(buckets, count, 0.99),
+                (unsigned long long)impl_mtx_hist_percentile(buckets, count, 0.999),
+                (unsigned long long)__atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED));
+    }
+    return thrd_success;
+}
+#else
+typedef void (*mtx_hold_cb_t)(mtx_t *mtx, const char *name, uint64_t hold_ns);
+
+static inline void
+mtx_set_hold_callback(mtx_hold_cb_t cb, unsigned long threshold_us)
+{
+    (void)cb; (void)threshold_us;
+}
+
+static inline int
+thrd_hold_dump(FILE *out)
+{
+    (void)out;
+    return thrd_success;
+}
+#endif  // EMULATED_THREADS_PROFILE_HOLD
+
+/*--------------------------- Tracing ---------------------------*/
+/*
+Implementation limits:
+  - Each thread keeps the last EMULATED_THREADS_TRACE_EVENTS events,
+    which must be a power of two.
+  - A thread not started by thrd_create() allocates its buffer on its
+    first event, unless it created a thread or called
+    thrd_trace_flush_at_exit() before.
+  - Events recorded while thrd_trace_flush() runs may be missing from
+    its output, and the oldest ones may be garbled when the ring wraps
+    during the flush.
+  - The buffer of an exited thread is reused by a new thread only after
+    it has been flushed; until then its events appear in every flush.
+  - Threads are identified by sequential ids, not OS thread ids.
+*/
+#ifdef EMULATED_THREADS_TRACE
+#ifndef EMULATED_THREADS_TRACE_EVENTS
+#define EMULATED_THREADS_TRACE_EVENTS 16384
+#endif
+#if EMULATED_THREADS_TRACE_EVENTS < 1 \
+    || (EMULATED_THREADS_TRACE_EVENTS & (EMULATED_THREADS_TRACE_EVENTS - 1)) != 0
+#error "EMULATED_THREADS_TRACE_EVENTS must be a power of two"
+#endif
+struct impl_trace_event {
+    uint64_t ts;
+    uint64_t dur;
+    const char *name;
+    const void *obj;
+    char ph;  // Chrome trace phase: 'B', 'E', 'X' or 'i'
+};
+
+struct impl_trace_buf {
+    struct impl_trace_buf *next;
+    long tid;
+    int state;  // IMPL_TRACE_*
+    uint64_t head;  // events ever recorded
+    struct impl_trace_event ev[EMULATED_THREADS_TRACE_EVENTS];
+};
+
+enum {
+    IMPL_TRACE_LIVE,
+    IMPL_TRACE_EXITED,
+    IMPL_TRACE_FLUSHED
+};
+
+IMPL_THRD_GLOBAL struct impl_trace_buf *impl_trace_bufs;
+IMPL_THRD_GLOBAL __thread struct impl_trace_buf *impl_trace_tls;
+IMPL_THRD_GLOBAL long impl_trace_next_tid;
+IMPL_THRD_GLOBAL const char *impl_trace_exit_path;
+IMPL_THRD_GLOBAL pthread_key_t impl_trace_key;
+IMPL_THRD_GLOBAL once_flag impl_trace_once = ONCE_FLAG_INIT;
+
+/* thread exit: the buffer is reused once its events have been flushed */
+static void
+impl_trace_release(void *p)
+{
+    struct impl_trace_buf *buf = (struct impl_trace_buf *)p;
+    __atomic_store_n(&buf->state, IMPL_TRACE_EXITED, __ATOMIC_RELEASE);
+}
+
+static void
+impl_trace_init(void)
+{
+    pthread_key_create(&impl_trace_key, impl_trace_release);
+}
+
+static inline struct impl_trace_buf *
+impl_trace_buf_get(void)
+{
+    struct impl_trace_buf *buf = impl_trace_tls;
+    if (buf)
+        return buf;
+
+    call_once(&impl_trace_once, impl_trace_init);
+    for (buf = __atomic_load_n(&impl_trace_bufs, __ATOMIC_ACQUIRE); buf; buf = buf->next) {
+        int expected = IMPL_TRACE_FLUSHED;
+        if (__atomic_compare_exchange_n(&buf->state, &expected, IMPL_TRACE_LIVE, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (buf) {
+        __atomic_store_n(&buf->head, 0, __ATOMIC_RELEASE);
+    } else {
+        buf = (struct impl_trace_buf *)calloc(1, sizeof(*buf));
+        if (!buf)
+            return NULL;
+        buf->next = __atomic_load_n(&impl_trace_bufs, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&impl_trace_bufs, &buf->next, buf, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    // sequential ids, in order of first event
+    buf->tid = __atomic_add_fetch(&impl_trace_next_tid, 1, __ATOMIC_RELAXED);
+    pthread_setspecific(impl_trace_key, buf);
+    impl_trace_tls = buf;
+    return buf;
+}
+
+static inline void
+impl_trace_record(char ph, const char *name, const void *obj, uint64_t ts, uint64_t dur)
+{
+    struct impl_trace_buf *buf = impl_trace_buf_get();
+    struct impl_trace_event *e;
+    if (!buf)
+        return;
+    e = &buf->ev[buf->head & (EMULATED_THREADS_TRACE_EVENTS - 1)];
+    e->ts = ts;
+    e->dur = dur;
+    e->name = name;
+    e->obj = obj;
+    e->ph = ph;
+    __atomic_store_n(&buf->head, buf->head + 1, __ATOMIC_RELEASE);
+}
+
+static inline void
+impl_trace_thrd_started(void)
+{
+    // allocates the buffer here rather than on a later, hotter path
+    impl_trace_record('B', "thread", NULL, thrd_clock_now(), 0);
+}
+
+static inline void
+impl_trace_thrd_exiting(void)
+{
+    impl_trace_record('E', "thread", NULL, thrd_clock_now(), 0);
+    if (impl_trace_tls) {
+        pthread_setspecific(impl_trace_key, NULL);
+        impl_trace_release(impl_trace_tls);
+        impl_trace_tls = NULL;
+    }
+}
+
+static inline void
+impl_trace_write_string(FILE *out, const char *str)
+{
+    fputc('"', out);
+    for (; *str; str++) {
+        unsigned char ch = (unsigned char)*str;
+        if (ch == '"' || ch == '\\')
+            fprintf(out, "\\%c", ch);
+        else if (ch < 0x20)
+            fprintf(out, "\\u%04x", ch);
+        else
+            fputc(ch, out);
+    }
+    fputc('"', out);
+}
+
+static inline void
+impl_trace_write_event(FILE *out, const struct impl_trace_event *e, long pid, long tid, int first)
+{
+    fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":%ld,\"tid\":%ld",
+            first ? "" : ",", e->name, e->ph,
+            (unsigned long long)(e->ts / 1000), (unsigned)(e->ts % 1000), pid, tid);
+    if (e->ph == 'X')
+        fprintf(out, ",\"dur\":%llu.%03u",
+                (unsigned long long)(e->dur / 1000), (unsigned)(e->dur % 1000));
+    if (e->ph == 'i')
+        fprintf(out, ",\"s\":\"t\"");
+    if (e->obj) {
+        const char *name = impl_mtx_get_name(e->obj);
+        fprintf(out, ",\"args\":{\"obj\":\"%p\"", e->obj);
+        if (name) {
+            fputs(",\"name\":", out);
+            impl_trace_write_string(out, name);
+        }
+        fputc('}', out);
+    }
+    fputc('}', out);
+}
+
+/*
+ * Write the events of all threads to `path' in Chrome trace-event JSON
+ * format, for chrome://tracing or ui.perfetto.dev. Timestamps are
+ * thrd_clock_now() values. Recording continues afterwards.
+ */
+static inline int
+thrd_trace_flush(const char *path)
+{
+    struct impl_trace_buf *buf;
+    long pid = (long)getpid();
+    int first = 1;
+    FILE *out;
+
+    assert(path != NULL);
+    out = fopen(path, "w");
+    if (!out)
+        return thrd_error;
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", out);
+    for (buf = __atomic_load_n(&impl_trace_bufs, __ATOMIC_ACQUIRE); buf; buf = buf->next) {
+        int state = __atomic_load_n(&buf->state, __ATOMIC_ACQUIRE);
+        uint64_t head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE), i;
+        i = head > EMULATED_THREADS_TRACE_EVENTS ? head - EMULATED_THREADS_TRACE_EVENTS : 0;
+        for (; i < head; i++) {
+            impl_trace_write_event(out, &buf->ev[i & (EMULATED_THREADS_TRACE_EVENTS - 1)],
+                                   pid, buf->tid, first);
+            first = 0;
+        }
+        if (state == IMPL_TRACE_EXITED)
+            __atomic_store_n(&buf->state, IMPL_TRACE_FLUSHED, __ATOMIC_RELEASE);
+    }
+    fputs("\n]}\n", out);
+    return (fclose(out) == 0) ? thrd_success : thrd_error;
+}
+
+static void
+impl_trace_atexit(void)
+{
+    thrd_trace_flush(impl_trace_exit_path);
+}
+
+/* Arrange for thrd_trace_flush(path) to run at exit(). `path' is not copied. */
+static inline int
+thrd_trace_flush_at_exit(const char *path)
+{
+    assert(path != NULL);
+    impl_trace_buf_get();  // the caller's buffer, before its first event
+    if (__atomic_exchange_n(&impl_trace_exit_path, path, __ATOMIC_ACQ_REL) != NULL)
+        return thrd_success;  // already registered
+    return (atexit(impl_trace_atexit) == 0) ? thrd_success : thrd_error;
+}
+#else
+static inline int
+thrd_trace_flush(const char *path)
+{
+    (void)path;
+    return thrd_success;
+}
+
+static inline int
+thrd_trace_flush_at_exit(const char *path)
+{
+    (void)path;
+    return thrd_success;
+}
+#endif  // EMULATED_THREADS_TRACE
+
+/*------------------------- Live statistics -------------------------*/
+/*
+Implementation limits:
+  - Only threads started by thrd_create() are counted as live.
+  - Counters are sharded over THRD_STATS_SHARDS cache lines; threads
+    beyond that share shards, still with exact totals.
+*/
+#ifdef EMULATED_THREADS_STATS
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define THRD_STATS_MAGIC 0x74313163u  // "c11t"
+#define THRD_STATS_VERSION 1
+#define THRD_STATS_SHARDS 64
+
+/* One cache line of event counters; sum over all shards for totals. */
+struct thrd_stats_shard {
+    uint64_t thrd_created;
+    uint64_t thrd_exited;
+    uint64_t mtx_contended;
+    uint64_t cnd_waits;
+    uint64_t cnd_timeouts;
+    uint64_t reserved[3];
+};
+
+/* Fixed layout shared with external readers, e.g. tools/thrdstat.c. */
+struct thrd_stats_segment {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t shards;
+    uint32_t pid;
+    uint64_t live_threads;
+    uint64_t peak_threads;
+    uint64_t reserved[4];
+    struct thrd_stats_shard shard[THRD_STATS_SHARDS];
+};
+
+IMPL_THRD_GLOBAL struct thrd_stats_segment impl_thrd_stats_local = {
+    THRD_STATS_MAGIC, THRD_STATS_VERSION, THRD_STATS_SHARDS, 0, 0, 0, {0}, {{0}}
+};
+IMPL_THRD_GLOBAL struct thrd_stats_segment *impl_thrd_stats = &impl_thrd_stats_local;
+IMPL_THRD_GLOBAL unsigned impl_thrd_stats_next_shard;
+IMPL_THRD_GLOBAL __thread struct thrd_stats_shard *impl_thrd_stats_tls;
+IMPL_THRD_GLOBAL __thread struct thrd_stats_segment *impl_thrd_stats_tls_seg;
+IMPL_THRD_GLOBAL __thread int impl_thrd_stats_live;
+
+static inline struct thrd_stats_shard *
+impl_thrd_stats_shard(void)
+{
+    struct thrd_stats_segment *seg = __atomic_load_n(&impl_thrd_stats, __ATOMIC_ACQUIRE);
+    if (impl_thrd_stats_tls_seg != seg) {
+        unsigned i = __atomic_fetch_add(&impl_thrd_stats_next_shard, 1, __ATOMIC_RELAXED);
+        impl_thrd_stats_tls = &seg->shard[i % THRD_STATS_SHARDS];
+        impl_thrd_stats_tls_seg = seg;
+    }
+    return impl_thrd_stats_tls;
+}
+
+#define IMPL_THRD_STATS_INC(field) \
+    __atomic_fetch_add(&impl_thrd_stats_shard()->field, 1, __ATOMIC_RELAXED)
+
+static inline void
+impl_thrd_stats_thrd_started(void)
+{
+    struct thrd_stats_segment *seg = __atomic_load_n(&impl_thrd_stats, __ATOMIC_ACQUIRE);
+    uint64_t live = __atomic_add_fetch(&seg->live_threads, 1, __ATOMIC_RELAXED);
+    uint64_t peak = __atomic_load_n(&seg->peak_threads, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&seg->peak_threads, &peak, live, 1,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    impl_thrd_stats_live = 1;
+    IMPL_THRD_STATS_INC(thrd_created);
+}
+
+static inline void
+impl_thrd_stats_thrd_exiting(void)
+{
+    struct thrd_stats_segment *seg = __atomic_load_n(&impl_thrd_stats, __ATOMIC_ACQUIRE);
+    if (!impl_thrd_stats_live)
+        return;  // e.g. thrd_exit() from the main thread
+    impl_thrd_stats_live = 0;
+    __atomic_sub_fetch(&seg->live_threads, 1, __ATOMIC_RELAXED);
+    IMPL_THRD_STATS_INC(thrd_exited);
+}
+
+/*
+ * Move the statistics into the file `path', creating it anew (an
+ * existing file or symbolic link of that name is removed, never
+ * followed), and keep updating them there. With a NULL path,
+ * /dev/shm/c11threads.<pid> is used. Counts made so far are carried
+ * over; events racing with the switch may be lost. Call once. The file
+ * is left in place at exit.
+ */
+static inline int
+thrd_stats_open(const char *path)
+{
+    struct thrd_stats_segment *seg;
+    char buf[64];
+    int fd;
+
+    if (!path) {
+        snprintf(buf, sizeof(buf), "/dev/shm/c11threads.%ld", (long)getpid());
+        path = buf;
+    }
+    // O_EXCL fails on anything already there, symbolic links included
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 && errno == EEXIST && unlink(path) == 0)
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return thrd_error;
+    if (ftruncate(fd, sizeof(*seg)) != 0) {
+        close(fd);
+        return thrd_error;
+    }
+    seg = (struct thrd_stats_segment *)mmap(NULL, sizeof(*seg), PROT_READ | PROT_WRITE,
+                                            MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED)
+        return thrd_error;
+    memcpy(seg, &impl_thrd_stats_local, sizeof(*seg));
+    seg->pid = (uint32_t)getpid();
+    __atomic_store_n(&impl_thrd_stats, seg, __ATOMIC_RELEASE);
+    return thrd_success;
+}
+#else
+static inline int
+thrd_stats_open(const char *path)
+{
+    (void)path;
+    return thrd_success;
+}
+#endif  // EMULATED_THREADS_STATS
+
+/*---------------------- Off-CPU wait accounting ----------------------*/
+/*
+Implementation limits:
+  - The records of exited threads are kept, and reused by new threads,
+    so thrd_wait_stats() on a joined thread works until its record or
+    its thrd_t value is taken over by another thread.
+*/
+struct thrd_wait_stats {
+    uint64_t mtx_ns;     // blocked in contended mtx_lock()/mtx_timedlock()
+    uint64_t mtx_waits;
+    uint64_t cnd_ns;     // in cnd_wait()/cnd_timedwait()
+    uint64_t cnd_waits;
+    uint64_t sleep_ns;   // in thrd_sleep()/thrd_sleep_until()
+    uint64_t sleeps;
+    uint64_t join_ns;    // in thrd_join()
+    uint64_t joins;
+};
+
+#ifdef EMULATED_THREADS_WAIT_STATS
+struct impl_wait_rec {
+    struct impl_wait_rec *next;
+    pthread_t thr;
+    int in_use;  // 2: live, 1: changing owner, 0: thread exited
+    struct thrd_wait_stats stats;
+};
+
+IMPL_THRD_GLOBAL struct impl_wait_rec *impl_wait_recs;
+IMPL_THRD_GLOBAL __thread struct impl_wait_rec *impl_wait_tls;
+IMPL_THRD_GLOBAL pthread_key_t impl_wait_key;
+IMPL_THRD_GLOBAL once_flag impl_wait_once = ONCE_FLAG_INIT;
+
+static void
+impl_wait_release(void *p)
+{
+    struct impl_wait_rec *rec = (struct impl_wait_rec *)p;
+    __atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void
+impl_wait_init(void)
+{
+    pthread_key_create(&impl_wait_key, impl_wait_release);
+}
+
+static inline struct impl_wait_rec *
+impl_wait_rec_get(void)
+{
+    struct impl_wait_rec *rec = impl_wait_tls;
+    if (rec)
+        return rec;
+
+    call_once(&impl_wait_once, impl_wait_init);
+    for (rec = __atomic_load_n(&impl_wait_recs, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&rec->in_use, &expected, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (rec) {
+        // hide the record while it changes owner
+        rec->thr = pthread_self();
+        memset(&rec->stats, 0, sizeof(rec->stats));
+        __atomic_store_n(&rec->in_use, 2, __ATOMIC_RELEASE);
+    } else {
+        rec = (struct impl_wait_rec *)calloc(1, sizeof(*rec));
+        if (!rec)
+            return NULL;
+        rec->thr = pthread_self();
+        rec->in_use = 2;
+        rec->next = __atomic_load_n(&impl_wait_recs, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&impl_wait_recs, &rec->next, rec, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    pthread_setspecific(impl_wait_key, rec);
+    impl_wait_tls = rec;
+    return rec;
+}
+
+static inline void
+impl_wait_stats_add(int kind, uint64_t ns)
+{
+    struct impl_wait_rec *rec = impl_wait_rec_get();
+    uint64_t *total, *count;
+    if (!rec)
+        return;
+    switch (kind) {
+    case IMPL_WAIT_MTX:   total = &rec->stats.mtx_ns;   count = &rec->stats.mtx_waits; break;
+    case IMPL_WAIT_CND:   total = &rec->stats.cnd_ns;   count = &rec->stats.cnd_waits; break;
+    case IMPL_WAIT_SLEEP: total = &rec->stats.sleep_ns; count = &rec->stats.sleeps; break;
+    default:              total = &rec->stats.join_ns;  count = &rec->stats.joins; break;
+    }
+    // only the owning thread writes its record
+    __atomic_store_n(total, *total + ns, __ATOMIC_RELAXED);
+    __atomic_store_n(count, *count + 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Fetch the time thread `thr' has spent blocked so far. Returns
+ * thrd_error if no such thread has been seen. Combine with
+ * timespec_get(TIME_THREAD_ACTIVE) in the thread itself for the on-CPU
+ * side.
+ */
+static inline int
+thrd_wait_stats(thrd_t thr, struct thrd_wait_stats *out)
+{
+    struct impl_wait_rec *rec;
+    int pass;
+    assert(out != NULL);
+    // live threads first, then exited ones whose record is not reused yet
+    for (pass = 0; pass < 2; pass++)
+    for (rec = __atomic_load_n(&impl_wait_recs, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+        int state = __atomic_load_n(&rec->in_use, __ATOMIC_ACQUIRE);
+        if (state != (pass == 0 ? 2 : 0) || !pthread_equal(rec->thr, thr))
+            continue;
+        out->mtx_ns = __atomic_load_n(&rec->stats.mtx_ns, __ATOMIC_RELAXED);
+        out->mtx_waits = __atomic_load_n(&rec->stats.mtx_waits, __ATOMIC_RELAXED);
+        out->cnd_ns = __atomic_load_n(&rec->stats.cnd_ns, __ATOMIC_RELAXED);
+        out->cnd_waits = __atomic_load_n(&rec->stats.cnd_waits, __ATOMIC_RELAXED);
+        out->sleep_ns = __atomic_load_n(&rec->stats.sleep_ns, __ATOMIC_RELAXED);
+        out->sleeps = __atomic_load_n(&rec->stats.sleeps, __ATOMIC_RELAXED);
+        out->join_ns = __atomic_load_n(&rec->stats.join_ns, __ATOMIC_RELAXED);
+        out->joins = __atomic_load_n(&rec->stats.joins, __ATOMIC_RELAXED);
+        return thrd_success;
+    }
+    return thrd_error;
+}
+#else
+static inline int
+thrd_wait_stats(thrd_t thr, struct thrd_wait_stats *out)
+{
+    (void)thr;
+    assert(out != NULL);
+    memset(out, 0, sizeof(*out));
+    return thrd_error;
+}
+#endif  // EMULATED_THREADS_WAIT_STATS
+
+/*------------------ Mutex instrumentation hooks ------------------*/
+#ifdef IMPL_THRD_MTX_HOOKS
+/* Called when a lock attempt found `mtx' held, before blocking on it. */
+static inline void
+impl_mtx_contend_begin(mtx_t *mtx)
+{
+    (void)mtx;
+    IMPL_THRD_PROBE1(mtx_contend_begin, mtx);
+#ifdef EMULATED_THREADS_PROFILE_LOCKS
+    // allocate now rather than once the caller holds mtx
+    impl_mtx_prof_buf_get();
+#endif
+}
+
+/* Called after a contended acquisition that waited from t0 to t1. */
+static inline void
+impl_mtx_contended(mtx_t *mtx, uint64_t t0, uint64_t t1)
+{
+    (void)mtx; (void)t0; (void)t1;
+    // t0 or t1 is 0 if the probe was enabled during the wait
+    if (IMPL_THRD_PROBE_ENABLED(mtx_contend_end) && t0 && t1)
+        IMPL_THRD_PROBE3(mtx_contend_end, mtx, t1 - t0, impl_mtx_get_name(mtx));
+#ifdef EMULATED_THREADS_PROFILE_LOCKS
+    impl_mtx_prof_contended(mtx, t1 - t0);
+#endif
+#ifdef EMULATED_THREADS_STATS
+    IMPL_THRD_STATS_INC(mtx_contended);
+#endif
+#ifdef EMULATED_THREADS_WAIT_STATS
+    impl_wait_stats_add(IMPL_WAIT_MTX, t1 - t0);
+#endif
+#ifdef EMULATED_THREADS_TRACE
+    impl_trace_record('X', "mtx_lock", mtx, t0, t1 - t0);
+#endif
+}
+
+static inline void
+impl_mtx_trylock_failed(mtx_t *mtx)
+{
+    (void)mtx;
+    IMPL_THRD_PROBE1(mtx_busy, mtx);
+#ifdef EMULATED_THREADS_PROFILE_LOCKS
+    impl_mtx_prof_trylock_failed(mtx);
+#endif
+}
+
+static inline void
+impl_mtx_acquired(mtx_t *mtx)
+{
+    (void)mtx;
+    IMPL_THRD_PROBE1(mtx_acquire, mtx);
+#ifdef EMULATED_THREADS_PROFILE_HOLD
+    impl_mtx_hold_acquired(mtx);
+#endif
+}
+
+/* Called with `mtx' still held; the result is passed to impl_mtx_release_end(). */
+static inline uint64_t
+impl_mtx_release_begin(mtx_t *mtx)
+{
+    (void)mtx;
+#ifdef EMULATED_THREADS_PROFILE_HOLD
+    return impl_mtx_hold_release_begin(mtx);
+#else
+    return 0;
+#endif
+}
+
+/* Called once `mtx' is released, or reacquired by a condvar wait (`relocked'). */
+static inline void
+impl_mtx_release_end(mtx_t *mtx, uint64_t hold_ns, int relocked)
+{
+    (void)mtx; (void)hold_ns; (void)relocked;
+    if (!relocked)
+        IMPL_THRD_PROBE1(mtx_release, mtx);
+#ifdef EMULATED_THREADS_PROFILE_HOLD
+    impl_mtx_hold_release_end(mtx, hold_ns, relocked);
+#endif
+}
+#endif  // IMPL_THRD_MTX_HOOKS
+
+/*------------------ Condvar instrumentation hooks ------------------*/
+#ifdef IMPL_THRD_CND_HOOKS
+/* Called with `mtx' held, before waiting on `cond'. */
+static inline void
+impl_cnd_wait_begin(struct impl_cnd_wait *w, cnd_t *cond, mtx_t *mtx)
+{
+    (void)cond;
+    IMPL_THRD_PROBE2(cnd_wait_begin, cond, mtx);
+    w->hold_ns = impl_mtx_release_begin(mtx);
+    w->t0 = IMPL_THRD_CND_CLOCK();
+}
+
+/* Called with `mtx' reacquired; `rt' is the pthread_cond_*wait() result. */
+static inline void
+impl_cnd_wait_end(struct impl_cnd_wait *w, cnd_t *cond, mtx_t *mtx, int rt)
+{
+    uint64_t t1 = IMPL_THRD_CND_CLOCK();
+    (void)cond; (void)rt; (void)t1;
+    IMPL_THRD_PROBE3(cnd_wait_end, cond, mtx, rt == ETIMEDOUT);
+#ifdef EMULATED_THREADS_TRACE
+    impl_trace_record('X', rt == ETIMEDOUT ? "cnd_wait (timeout)" : "cnd_wait",
+                      cond, w->t0, t1 - w->t0);
+#endif
+#ifdef EMULATED_THREADS_STATS
+    IMPL_THRD_STATS_INC(cnd_waits);
+    if (rt == ETIMEDOUT)
+        IMPL_THRD_STATS_INC(cnd_timeouts);
+#endif
+#ifdef EMULATED_THREADS_WAIT_STATS
+    impl_wait_stats_add(IMPL_WAIT_CND, t1 - w->t0);
+#endif
+    impl_mtx_acquired(mtx);
+    impl_mtx_release_end(mtx, w->hold_ns, 1);
+}
+#endif  // IMPL_THRD_CND_HOOKS
+
+/*------------------ Thread instrumentation hooks ------------------*/
+#ifdef IMPL_THRD_THRD_HOOKS
+/* Called in the creating thread after a successful thrd_create(). */
+static inline void
+impl_thrd_created(thrd_t thr)
+{
+    (void)thr;
+    IMPL_THRD_PROBE1(thrd_create, thr);
+#ifdef EMULATED_THREADS_TRACE
+    // also gives the creating thread its buffer, off its lock paths
+    impl_trace_record('i', "thrd_create", NULL, thrd_clock_now(), 0);
+#endif
+}
+
+/* Called in a new thread before its start function. */
+static inline void
+impl_thrd_started(void)
+{
+    IMPL_THRD_PROBE0(thrd_start);
+#ifdef EMULATED_THREADS_TRACE
+    impl_trace_thrd_started();
+#endif
+#ifdef EMULATED_THREADS_STATS
+    impl_thrd_stats_thrd_started();
+#endif
+#ifdef EMULATED_THREADS_WAIT_STATS
+    impl_wait_rec_get();  // make the thread known to thrd_wait_stats()
+#endif
+}
+
+/* Called in a thread returning from its start function or calling thrd_exit(). */
+static inline void
+impl_thrd_exiting(int res)
+{
+    (void)res;
+    IMPL_THRD_PROBE1(thrd_exit, res);
+#ifdef EMULATED_THREADS_TRACE
+    impl_trace_thrd_exiting();
+#endif
+#ifdef EMULATED_THREADS_STATS
+    impl_thrd_stats_thrd_exiting();
+#endif
+}
+#endif  // IMPL_THRD_THRD_HOOKS
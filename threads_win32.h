@@ -32,6 +32,7 @@
 #include <limits.h>
 #include <errno.h>
 #include <process.h>  // MSVCRT
+#include <stdint.h>
 #include <stdlib.h>
 
 /*
@@ -647,8 +648,47 @@ tss_set(tss_t key, void *val)
 
 
 /*-------------------- 7.25.7 Time functions --------------------*/
-// 7.25.6.1
 #ifndef HAVE_TIMESPEC_GET
+static inline void
+impl_filetime2timespec(const FILETIME *ft, struct timespec *ts)
+{
+    ULONGLONG t = ((ULONGLONG)ft->dwHighDateTime << 32) | ft->dwLowDateTime;
+    ts->tv_sec = (time_t)(t / 10000000);
+    ts->tv_nsec = (long)(t % 10000000) * 100;
+}
+
+static inline int
+impl_timespec_get_monotonic(struct timespec *ts)
+{
+    LARGE_INTEGER freq, count;
+    if (!QueryPerformanceFrequency(&freq) || !QueryPerformanceCounter(&count))
+        return 0;
+    ts->tv_sec = (time_t)(count.QuadPart / freq.QuadPart);
+    ts->tv_nsec = (long)((count.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart);
+    return 1;
+}
+
+static inline int
+impl_timespec_get_cputime(struct timespec *ts, int thread)
+{
+    FILETIME creation, exit, kernel, user;
+    ULARGE_INTEGER k, u;
+    BOOL ok;
+    if (thread)
+        ok = GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+    else
+        ok = GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+    if (!ok)
+        return 0;
+    k.LowPart = kernel.dwLowDateTime; k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime; u.HighPart = user.dwHighDateTime;
+    k.QuadPart += u.QuadPart;
+    kernel.dwLowDateTime = k.LowPart; kernel.dwHighDateTime = k.HighPart;
+    impl_filetime2timespec(&kernel, ts);
+    return 1;
+}
+
+// 7.25.6.1
 static inline int
 timespec_get(struct timespec *ts, int base)
 {
@@ -658,6 +698,69 @@ timespec_get(struct timespec *ts, int base)
         ts->tv_nsec = 0;
         return base;
     }
+    if (base == TIME_MONOTONIC)
+        return impl_timespec_get_monotonic(ts) ? base : 0;
+    if (base == TIME_ACTIVE || base == TIME_THREAD_ACTIVE)
+        return impl_timespec_get_cputime(ts, base == TIME_THREAD_ACTIVE) ? base : 0;
+    return 0;
+}
+#endif
+
+#ifndef HAVE_TIMESPEC_GETRES
+static inline int
+timespec_getres(struct timespec *res, int base)
+{
+    LARGE_INTEGER freq;
+    struct timespec dummy;
+    if (!res) res = &dummy;
+    switch (base) {
+    case TIME_UTC:
+#ifdef HAVE_TIMESPEC_GET
+        // UCRT timespec_get() reads a FILETIME
+        res->tv_sec = 0;
+        res->tv_nsec = 100;
+#else
+        // matches the time(NULL) based timespec_get() above
+        res->tv_sec = 1;
+        res->tv_nsec = 0;
+#endif
+        return base;
+    case TIME_MONOTONIC:
+        if (!QueryPerformanceFrequency(&freq))
+            return 0;
+        res->tv_sec = 0;
+        res->tv_nsec = (long)((1000000000 + freq.QuadPart - 1) / freq.QuadPart);
+        return base;
+    case TIME_ACTIVE:
+    case TIME_THREAD_ACTIVE:
+        // FILETIME ticks are 100ns
+        res->tv_sec = 0;
+        res->tv_nsec = 100;
+        return base;
+    }
     return 0;
 }
 #endif
+
+
+/*------------------- Non-standard extensions -------------------*/
+/*
+ * Nanoseconds on the TIME_MONOTONIC time line. QueryPerformanceCounter()
+ * already reads the invariant TSC when the system provides one. The
+ * frequency is fixed at boot and cheap to query, so it is read every call.
+ */
+static inline uint64_t
+thrd_clock_now(void)
+{
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000u
+        + (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000u / freq.QuadPart;
+}
+
+/* QueryPerformanceCounter() needs no calibration. */
+static inline void
+thrd_clock_calibrate(void)
+{
+}
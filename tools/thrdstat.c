@@ -0,0 +1,95 @@
+/*
+ * Sample the live statistics segment of a process built with
+ * EMULATED_THREADS_STATS, see thrd_stats_open().
+ *
+ * Usage: thrdstat <pid | path> [interval_ms] [count]
+ *
+ * Build: cc -std=c99 -O2 -DHAVE_PTHREAD -I.. -I<mesa>/include thrdstat.c -o thrdstat -lpthread
+ */
+#define _POSIX_C_SOURCE 200809L
+#define EMULATED_THREADS_STATS
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "threads.h"
+
+struct totals {
+    uint64_t created, exited, contended, waits, timeouts;
+};
+
+static void
+sum(const volatile struct thrd_stats_segment *seg, struct totals *t)
+{
+    unsigned i;
+    memset(t, 0, sizeof(*t));
+    for (i = 0; i < seg->shards && i < THRD_STATS_SHARDS; i++) {
+        t->created += seg->shard[i].thrd_created;
+        t->exited += seg->shard[i].thrd_exited;
+        t->contended += seg->shard[i].mtx_contended;
+        t->waits += seg->shard[i].cnd_waits;
+        t->timeouts += seg->shard[i].cnd_timeouts;
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    const volatile struct thrd_stats_segment *seg;
+    struct totals prev, cur;
+    char path[256];
+    long interval_ms, count, n;
+    double secs;
+    int fd;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <pid | path> [interval_ms] [count]\n", argv[0]);
+        return 2;
+    }
+    if (isdigit((unsigned char)argv[1][0]))
+        snprintf(path, sizeof(path), "/dev/shm/c11threads.%s", argv[1]);
+    else
+        snprintf(path, sizeof(path), "%s", argv[1]);
+    interval_ms = argc > 2 ? atol(argv[2]) : 1000;
+    count = argc > 3 ? atol(argv[3]) : -1;
+    if (interval_ms <= 0)
+        interval_ms = 1000;
+    secs = interval_ms / 1000.0;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    seg = (const volatile struct thrd_stats_segment *)
+        mmap(NULL, sizeof(*seg), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    if (seg->magic != THRD_STATS_MAGIC || seg->version != THRD_STATS_VERSION) {
+        fprintf(stderr, "%s: not a version %d statistics segment\n", path, THRD_STATS_VERSION);
+        return 1;
+    }
+
+    printf("%8s %8s %10s %12s %12s %12s\n",
+           "live", "peak", "creates/s", "contended/s", "cnd_waits/s", "timeouts/s");
+    sum(seg, &prev);
+    for (n = 0; count < 0 || n < count; n++) {
+        struct timespec d;
+        d.tv_sec = interval_ms / 1000;
+        d.tv_nsec = (interval_ms % 1000) * 1000000;
+        thrd_sleep(&d, NULL);
+        sum(seg, &cur);
+        printf("%8llu %8llu %10.1f %12.1f %12.1f %12.1f\n",
+               (unsigned long long)seg->live_threads,
+               (unsigned long long)seg->peak_threads,
+               (cur.created - prev.created) / secs,
+               (cur.contended - prev.contended) / secs,
+               (cur.waits - prev.waits) / secs,
+               (cur.timeouts - prev.timeouts) / secs);
+        fflush(stdout);
+        prev = cur;
+    }
+    return 0;
+}